@@ -0,0 +1,172 @@
+/* Copyright 2023 Collin Bollinger
+ *
+ * bcm_matrix.cpp
+ */
+
+#include "bcm_matrix.h"
+#include "executive.h"
+#include "trace.h"
+
+// Gamma corrected output level for every 8 bit input intensity, generated at compile time
+struct BcmGammaTable {
+    uint8_t level[256];
+
+    // x^(1/5) for x in [0, 1] by Newton's method, so that x^2.2 = x^2 * x^0.2 can be evaluated in a constant expression
+    static constexpr double fifthRoot(double x){
+        if (x <= 0) return 0;
+        double y = 1;
+        for (int i = 0; i < 40; i++) { y = (4 * y + x / (y * y * y * y)) / 5; }
+        return y;
+    }
+
+    constexpr BcmGammaTable() : level() {
+        for (int i = 0; i < 256; i++) {
+            double x = i / 255.0;
+            level[i] = static_cast<uint8_t>(x * x * fifthRoot(x) * ((1 << BCM_BITS) - 1) + 0.5);
+        }
+    }
+};
+
+constexpr BcmGammaTable bcmGamma;
+
+static_assert(bcmGamma.level[0] == 0 & bcmGamma.level[255] == (1 << BCM_BITS) - 1, "Gamma table must span every level");
+
+uint8_t bcmPlanes[BCM_BITS][SCAN_ROWS][WIDTH_PX];
+
+uint8_t bcmPalette[8][3] = {
+    { 0, 0, 0 },       // Off
+    { 0, 255, 0 },     // COLOR_GREEN
+    { 0, 0, 255 },     // COLOR_BLUE
+    { 0, 255, 255 },   // COLOR_TEAL
+    { 255, 0, 0 },     // COLOR_RED
+    { 255, 255, 0 },   // COLOR_YELLOW
+    { 255, 0, 255 },   // COLOR_MAGENTA
+    { 255, 255, 255 }, // COLOR_WHITE
+};
+
+// Row select lines of the row pair currently latched, with OE enabled while a plane is lit
+uint32_t bcmLitWord = PORT_OE;
+
+// When the currently lit plane was latched and how long it has to stay lit
+uint32_t bcmLitStart = 0;
+uint32_t bcmLitTime = 0;
+
+// Longest time shifting one plane into the panel took, in microseconds
+uint32_t bcmShiftTime = 0;
+
+// Gamma corrected level of one channel of a palette color, dimmed or not. A dimmed channel that is on keeps at least
+// the lowest level, so it doesn't go dark with few BCM_BITS
+inline uint8_t paletteLevel(uint8_t intensity, bool dim){
+    if (!dim) return bcmGamma.level[intensity];
+    uint8_t level = bcmGamma.level[intensity * BCM_DIM / 255];
+    return level == 0 && intensity > 0 ? 1 : level;
+}
+
+void bcm_load_frame(const port_word_t rows[][WIDTH_PX]){
+
+    // Split every palette entry into its planes once, full and dimmed (entries 8-15), then every pixel is a table
+    // lookup per plane
+    uint8_t planeColor[16][BCM_BITS];
+    for (uint8_t entry = 0; entry < 16; entry++) {
+        const uint8_t *color = bcmPalette[entry & 7];
+        uint8_t red = paletteLevel(color[0], entry & 8);
+        uint8_t green = paletteLevel(color[1], entry & 8);
+        uint8_t blue = paletteLevel(color[2], entry & 8);
+        for (uint8_t p = 0; p < BCM_BITS; p++) {
+            planeColor[entry][p] = (((red >> p) & 1) * COLOR_RED) | (((green >> p) & 1) * COLOR_GREEN) | (((blue >> p) & 1) * COLOR_BLUE);
+        }
+    }
+
+    for (uint8_t row = 0; row < SCAN_ROWS; row++) {
+        for (uint8_t col = 0; col < WIDTH_PX; col++) {
+            port_word_t word = rows[row][col];
+            uint8_t top = (word >> PORT_RGB1_SHIFT & 7) | (word & PORT_DIM1 ? 8 : 0);
+            uint8_t bottom = (word >> PORT_RGB2_SHIFT & 7) | (word & PORT_DIM2 ? 8 : 0);
+            for (uint8_t p = 0; p < BCM_BITS; p++) {
+                bcmPlanes[p][row][col] = planeColor[top][p] | (planeColor[bottom][p] << 3);
+            }
+        }
+    }
+}
+
+// Keep the lit plane on until its weighted time is over, then blank the panel. Shifts after this keep it blank
+inline void bcm_finish_lit_plane(){
+    if (bcmLitWord & PORT_OE) return;
+    uint32_t elapsed = us_ticker_read() - bcmLitStart;
+    if (elapsed < bcmLitTime) { wait_us(bcmLitTime - elapsed); }
+    GPIOC->PSOR = PORT_OE; // OE LOW
+    bcmLitWord |= PORT_OE;
+    scanStats.litUs += us_ticker_read() - bcmLitStart;
+}
+
+// Waits until deadline (us_ticker_read() time), sleeping through as many whole RTOS ticks of it as fit, so that the
+// lower priority threads run in the meantime. A sleep of n ticks never lasts longer than n ms
+inline void bcm_wait_until(uint32_t deadline){
+    int32_t left = static_cast<int32_t>(deadline - us_ticker_read());
+    if (left >= 1000) { thread_sleep_for(left / 1000); }
+    left = static_cast<int32_t>(deadline - us_ticker_read());
+    if (left > 0) { wait_us(left); }
+}
+
+// Blank a row pair once its planes are done. The executive gets the rest of the row slot for its work. Otherwise the
+// next row pair follows straight away, and the slots left over are waited out in one go at the end of the frame
+inline void bcm_finish_row(uint32_t rowStart){
+    bcm_finish_lit_plane();
+#if EXECUTIVE_ENABLED
+    executive_idle(rowStart + scanSchedule.rowUs);
+    bcm_wait_until(rowStart + scanSchedule.rowUs);
+#endif
+}
+
+void bcm_scan_frame(){
+
+    uint32_t rowStart = 0, frameStart = 0;
+    for (uint8_t row_counter = 0; row_counter < SCAN_ROWS; row_counter++) {
+
+        // the rgb matrix indexes rows from top to bottom, so the row counter must be flipped
+        uint8_t row_out = SCAN_ROWS - 1 - row_counter;
+
+        for (uint8_t p = 0; p < BCM_BITS; p++) {
+
+            // Shift the next plane in while the previous one is still lit
+            const uint8_t *columns = bcmPlanes[p][row_counter];
+            uint32_t port = bcmLitWord;
+            uint32_t shiftStart = us_ticker_read();
+            for (int col = 0; col < WIDTH_PX; col++) {
+                GPIOC->PDOR = port | (columns[col] << PORT_RGB1_SHIFT);
+                GPIOC->PDOR = port | (columns[col] << PORT_RGB1_SHIFT) | PORT_CLK;
+            }
+            uint32_t shiftTime = us_ticker_read() - shiftStart;
+            if (shiftTime > bcmShiftTime) bcmShiftTime = shiftTime;
+
+            if (p == 0 && row_counter > 0) { bcm_finish_row(rowStart); }
+            else { bcm_finish_lit_plane(); }
+
+            bcmLitWord = row_out << PORT_ROW_SHIFT;
+            GPIOC->PDOR = bcmLitWord | PORT_LAT; // Set row select and set LATCH, which also enables OE
+            GPIOC->PCOR = PORT_LAT; // Clear latch
+            bcmLitStart = us_ticker_read();
+            bcmLitTime = (scanSchedule.litUs << p) / ((1 << BCM_BITS) - 1);
+            if (p == 0) {
+                rowStart = bcmLitStart;
+                if (row_counter == 0) frameStart = rowStart;
+                TRACE_ROW_LATCHED(row_counter);
+            }
+
+            // Planes that are lit for less time than a shift takes can't overlap the next shift, or they would stay
+            // on too long and lose their weighting. Finish them before shifting
+            if (bcmLitTime < bcmShiftTime) { bcm_finish_lit_plane(); }
+        }
+    }
+    bcm_finish_row(rowStart);
+
+    // A frame lasts SCAN_ROWS row slots whether or not the rows were scanned back to back, so the refresh rate and
+    // the share of it each row is lit for stay what the scan schedule asks for. The blank rest of the frame is several
+    // ticks long, which gives the main thread time to send the trace dumps and mirror packets
+    bcm_wait_until(frameStart + SCAN_ROWS * scanSchedule.rowUs);
+}
+
+void bcm_report(){
+    printf("\n\rBCM: %i bits per channel, LSB %i us, ideal %i Hz, longest plane shift %u us",
+           BCM_BITS, BCM_LSB_US, 1000000 / BCM_FRAME_US, (unsigned)bcmShiftTime);
+}
@@ -0,0 +1,65 @@
+/* Copyright 2023 Collin Bollinger
+ *
+ * bcm_matrix.h
+ *
+ * Binary Code Modulation scan engine. Each pixel gets BCM_BITS bits per channel by splitting the frame into bit
+ * planes and lighting plane p for BCM_LSB_US << p microseconds, so the eye averages the planes into 2^BCM_BITS levels.
+ */
+
+#ifndef BCM_MATRIX_H
+#define BCM_MATRIX_H
+
+#include "pong.h"
+
+#ifndef BCM_ENABLED
+#define BCM_ENABLED 0 // Set to 1 to scan the matrix with the BCM engine instead of the 1 bit per channel scan loop
+#endif
+
+#ifndef BCM_BITS
+#define BCM_BITS 4 // Bits per channel. 4-6 are sensible, each extra bit doubles the frame time
+#endif
+
+#ifndef BCM_LSB_US
+#define BCM_LSB_US 8 // On time of the least significant bit plane in microseconds
+#endif
+
+#define BCM_DIM 64 // Intensity out of 255 that a dimmed pixel is scaled to before gamma. Change as necessary
+
+static_assert(!(BCM_ENABLED & SCAN_INTERRUPT), "The BCM engine scans from the thread loop, build it with SCAN_INTERRUPT=0");
+
+#define BCM_MIN_REFRESH_HZ 100 // Refresh rate below which the panel visibly flickers
+
+// Lit time of a row pair at full brightness, with every plane lit for exactly its weight: (2^BCM_BITS - 1) LSB times
+#define BCM_ROW_US (((1 << BCM_BITS) - 1) * BCM_LSB_US)
+
+// Frame time at full brightness: 16 row pairs of BCM_ROW_US
+#define BCM_FRAME_US (SCAN_ROWS * BCM_ROW_US)
+
+static_assert(BCM_BITS >= 1 & BCM_BITS <= 8, "BCM_BITS must be between 1 and 8");
+static_assert(1000000 / BCM_FRAME_US >= BCM_MIN_REFRESH_HZ, "BCM_BITS and BCM_LSB_US give a refresh rate that flickers");
+
+// Bit planes for every row pair. Each byte holds one column of one row pair for one bit: bits 0-2 are the RGB1 lanes
+// and bits 3-5 the RGB2 lanes, so byte << PORT_RGB1_SHIFT is ready to write to port C
+static_assert(PORT_RGB2_SHIFT == PORT_RGB1_SHIFT + 3, "Bit planes need the RGB2 lanes right above the RGB1 lanes");
+extern uint8_t bcmPlanes[BCM_BITS][SCAN_ROWS][WIDTH_PX];
+
+// 8 bit intensity of every game color (COLOR_RED etc.) when shown through the BCM engine, in red, green, blue order
+extern uint8_t bcmPalette[8][3];
+
+/* Converts a frame buffer into bit planes, mapping every game color through bcmPalette, scaled down to BCM_DIM for a
+ * pixel with its dim bit (PORT_DIM1 or PORT_DIM2) set */
+void bcm_load_frame(const port_word_t rows[][WIDTH_PX]);
+
+/* Scans every row pair once, showing every bit plane for its weighted on time scaled by scanSchedule.brightness, and
+ * blanks each row pair once its planes are done. In the executive build each row pair starts scanSchedule.rowUs after
+ * the one before and the executive works in the blank rest of the slot. Otherwise the row pairs follow each other
+ * straight away, and the matrix thread sleeps through the blank rest of the frame of SCAN_ROWS row slots, so it doesn't
+ * starve the lower priority threads */
+void bcm_scan_frame();
+
+/* Prints the BCM configuration and the longest time taken to shift one plane into the panel. The achieved refresh
+ * rate is in rgb_matrix_report() and the trace frame period histogram. Called by the main thread after each trace
+ * dump */
+void bcm_report();
+
+#endif
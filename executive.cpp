@@ -0,0 +1,66 @@
+/* Copyright 2023 Collin Bollinger
+ *
+ * executive.cpp
+ */
+
+#include "executive.h"
+#include "trace.h"
+
+ExecutiveStats executiveStats;
+
+uint32_t nextStep_us = 0; // When the next simulation step is due
+bool scenePublished = false; // A step published a scene that hasn't been drawn yet
+
+void executive_init(){
+    simulation_init();
+    rgb_matrix_init();
+    nextStep_us = us_ticker_read();
+}
+
+void executive_idle(uint32_t deadline){
+
+    executiveStats.windows++;
+    uint32_t start = us_ticker_read();
+    int32_t late = static_cast<int32_t>(start - nextStep_us);
+
+    if(late >= 0){
+        TRACE_VALUE(TRACE_WAKEUP_LATENCY, late);
+        simulation_step(game);
+        publishSnapshot(game);
+        scenePublished = true;
+        executiveStats.steps++;
+
+        // Same cadence as the sleep in simulate(), but counted from when the step was due rather than when it ran, so
+        // that waiting for a window doesn't slow the steps down. After a long hold up it starts afresh
+        uint32_t sleep_ms = eventDrivenSimulation ? simulation_sleep_ms(game) : 1;
+        nextStep_us += sleep_ms * 1000;
+        if(static_cast<int32_t>(start - nextStep_us) >= 0) { nextStep_us = start + sleep_ms * 1000; }
+    } else if(scenePublished){
+        // A scene still waiting to be swapped in stays, and the latest one is drawn in a later window
+        if(!rgb_matrix_render()) return;
+        scenePublished = false;
+        executiveStats.renderWindows++;
+    } else {
+        return;
+    }
+
+    uint32_t end = us_ticker_read();
+    if(end - start > executiveStats.longestWorkUs) { executiveStats.longestWorkUs = end - start; }
+    if(static_cast<int32_t>(end - deadline) > 0) { executiveStats.overruns++; }
+}
+
+void executive_run(void (*report)(), uint32_t report_ms){
+
+    executive_init();
+
+    uint32_t reported_us = us_ticker_read();
+    for(;;){
+        rgb_matrix_frame();
+
+        if(report && us_ticker_read() - reported_us >= report_ms * 1000){
+            rgb_matrix_blank(); // Or the last row would stay lit for the whole report
+            report();
+            reported_us = us_ticker_read();
+        }
+    }
+}
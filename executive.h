@@ -0,0 +1,41 @@
+/* Copyright 2023 Collin Bollinger
+ *
+ * executive.h
+ *
+ * Cooperative executive. With EXECUTIVE_ENABLED, main() starts one thread that runs everything from one loop instead
+ * of the simulation and matrix threads: the loop scans the matrix with rgb_matrix_frame(), and the simulation and scene
+ * drawing run in the idle part of each row slot, once the row is latched and, if it is only lit for part of the slot,
+ * blanked again. Each idle window does at most one piece of work, a simulation step when one is due or else drawing
+ * the scene the last step published, so the work always happens at the same point of a row and never moves the
+ * edges of the scan. There are no context switches, and the snapshot and swap handshakes between the threads are
+ * never contended. The cost is that simulation steps are held up until the next idle window, at most a row slot.
+ */
+
+#ifndef EXECUTIVE_H
+#define EXECUTIVE_H
+
+#include "pong.h"
+
+// What the executive did, for reports and the host comparison
+struct ExecutiveStats {
+    uint32_t windows; // Idle windows offered by the scan
+    uint32_t steps; // Simulation steps run in them
+    uint32_t renderWindows; // Windows spent on a published scene, drawn or found unchanged (see renderStats.scenes)
+    uint32_t overruns; // Work that went past the end of its window and held up the scan
+    uint32_t longestWorkUs; // Longest any one piece of work took
+};
+
+extern ExecutiveStats executiveStats;
+
+/* Sets up the game and the matrix. Called by executive_run() */
+void executive_init();
+
+/* Runs the work that is due, if any, in an idle window of the scan that ends at deadline (us_ticker_read() time).
+ * Called by the scan loop */
+void executive_idle(uint32_t deadline);
+
+/* The executive's loop: scans frames forever. Every report_ms, report is called between two frames with the panel
+ * blanked, for output that takes longer than an idle window. Never returns */
+void executive_run(void (*report)(), uint32_t report_ms);
+
+#endif
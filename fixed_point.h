@@ -0,0 +1,147 @@
+/* Copyright 2023 Collin Bollinger
+ *
+ * fixed_point.h
+ *
+ * Q16.16 fixed point numbers for the ball and paddle physics. The KL25Z's Cortex-M0+ has no FPU, so every float
+ * operation in the simulation is a library call. Building with PONG_FIXED_POINT=1 switches the physics to Fix16, which
+ * only needs integer adds, shifts and the occasional 64 bit multiply or divide.
+ */
+
+#ifndef FIXED_POINT_H
+#define FIXED_POINT_H
+
+#include <stdint.h>
+
+#ifndef PONG_FIXED_POINT
+#define PONG_FIXED_POINT 0 // Set to 1 to run the physics in Q16.16 fixed point instead of float
+#endif
+
+// Signed Q16.16 fixed point number: 16 integer bits (including sign) and 16 fraction bits
+class Fix16 {
+public:
+    int32_t raw;
+
+    constexpr Fix16() : raw(0) {}
+    constexpr Fix16(int value) : raw(value * 65536) {}
+    constexpr Fix16(double value) : raw(static_cast<int32_t>(value * 65536 + (value >= 0 ? 0.5 : -0.5))) {}
+
+    static constexpr Fix16 fromRaw(int32_t raw) { Fix16 f; f.raw = raw; return f; }
+
+    // Rounds towards negative infinity like a shift, unlike the truncation of a float to int cast
+    constexpr int toInt() const { return raw >> 16; }
+    constexpr float toFloat() const { return raw / 65536.0f; }
+
+    friend constexpr Fix16 operator+(Fix16 a, Fix16 b) { return fromRaw(a.raw + b.raw); }
+    friend constexpr Fix16 operator-(Fix16 a, Fix16 b) { return fromRaw(a.raw - b.raw); }
+    friend constexpr Fix16 operator*(Fix16 a, Fix16 b) { return fromRaw(static_cast<int32_t>((static_cast<int64_t>(a.raw) * b.raw) >> 16)); }
+    friend constexpr Fix16 operator/(Fix16 a, Fix16 b) { return fromRaw(static_cast<int32_t>((static_cast<int64_t>(a.raw) * 65536) / b.raw)); }
+    constexpr Fix16 operator-() const { return fromRaw(-raw); }
+
+    Fix16 &operator+=(Fix16 b) { raw += b.raw; return *this; }
+    Fix16 &operator-=(Fix16 b) { raw -= b.raw; return *this; }
+    Fix16 &operator*=(Fix16 b) { *this = *this * b; return *this; }
+    Fix16 &operator/=(Fix16 b) { *this = *this / b; return *this; }
+
+    friend constexpr bool operator==(Fix16 a, Fix16 b) { return a.raw == b.raw; }
+    friend constexpr bool operator!=(Fix16 a, Fix16 b) { return a.raw != b.raw; }
+    friend constexpr bool operator<(Fix16 a, Fix16 b) { return a.raw < b.raw; }
+    friend constexpr bool operator<=(Fix16 a, Fix16 b) { return a.raw <= b.raw; }
+    friend constexpr bool operator>(Fix16 a, Fix16 b) { return a.raw > b.raw; }
+    friend constexpr bool operator>=(Fix16 a, Fix16 b) { return a.raw >= b.raw; }
+};
+
+/* Time in seconds as an unsigned Q0.32 fraction, for the time the ball moves in a step. SIM_STEP_US in Q16.16 would be
+ * 66/65536 s instead of 1 ms, which runs the fixed point game 0.7% fast; in Q0.32 it is off by less than 1e-7. A
+ * slope times a StepTime is rounded to the nearest Q16.16 value instead of truncated, so the error doesn't build up
+ * one way over the steps either */
+class StepTime {
+public:
+    uint32_t raw;
+
+    constexpr StepTime() : raw(0) {}
+    constexpr StepTime(double seconds) : raw(static_cast<uint32_t>(seconds * 4294967296.0 + 0.5)) {}
+    // From a time worked out in Q16.16, which can come out negative or past a whole step by rounding
+    constexpr StepTime(Fix16 seconds) : raw(seconds.raw < 0 ? 0 : static_cast<uint32_t>(seconds.raw) << 16) {}
+
+    constexpr operator Fix16() const { return Fix16::fromRaw(static_cast<int32_t>((raw + 0x8000u) >> 16)); }
+
+    friend constexpr Fix16 operator*(Fix16 a, StepTime t) {
+        return Fix16::fromRaw(static_cast<int32_t>((static_cast<int64_t>(a.raw) * t.raw + (1ll << 31)) >> 32));
+    }
+    friend constexpr Fix16 operator*(StepTime t, Fix16 a) { return a * t; }
+
+    // Never goes below 0, for the same reason
+    StepTime &operator-=(StepTime b) { raw = b.raw < raw ? raw - b.raw : 0; return *this; }
+};
+
+inline constexpr Fix16 abs(Fix16 x) { return x.raw < 0 ? -x : x; }
+
+/* Square root of a Q32.32 value (the product of two Q16.16 raws), returned as Q16.16. Bit by bit integer square
+ * root, so no division is needed */
+inline Fix16 fix16_sqrt_q32(uint64_t value){
+    uint64_t result = 0;
+    uint64_t bit = 1ull << 62;
+    while (bit > value) bit >>= 2;
+    while (bit) {
+        if (value >= result + bit) {
+            value -= result + bit;
+            result = (result >> 1) + bit;
+        } else {
+            result >>= 1;
+        }
+        bit >>= 2;
+    }
+    return Fix16::fromRaw(static_cast<int32_t>(result));
+}
+
+inline Fix16 sqrt(Fix16 x){ return x.raw <= 0 ? Fix16() : fix16_sqrt_q32(static_cast<uint64_t>(x.raw) << 16); }
+
+// sqrt(1 - r^2) for r in [0, 1], the x component of a unit vector whose y component is r. Used to turn a y slope
+// and a speed into the matching x slope without a square root
+struct UnitCircleTable {
+    static const int STEPS = 64;
+    int32_t x[STEPS + 1]; // Q16.16 raw values at r = i / STEPS
+
+    static constexpr double sqrtNewton(double v){
+        if (v <= 0) return 0;
+        double y = v < 1 ? 1 : v;
+        for (int i = 0; i < 60; i++) { y = (y + v / y) / 2; }
+        return y;
+    }
+
+    constexpr UnitCircleTable() : x() {
+        for (int i = 0; i <= STEPS; i++) {
+            double r = static_cast<double>(i) / STEPS;
+            x[i] = static_cast<int32_t>(sqrtNewton(1 - r * r) * 65536 + 0.5);
+        }
+    }
+};
+
+constexpr UnitCircleTable unitCircle;
+
+/* sqrt(1 - r^2) by linear interpolation in unitCircle. |r| is clamped to 1 */
+inline Fix16 unitCircleX(Fix16 r){
+    int32_t a = r.raw < 0 ? -r.raw : r.raw;
+    if (a >= 65536) return Fix16();
+    int32_t scaled = a * UnitCircleTable::STEPS; // Table index in the upper 16 bits, interpolation weight in the lower
+    int32_t i = scaled >> 16;
+    int32_t weight = scaled & 0xFFFF;
+    int32_t x0 = unitCircle.x[i], x1 = unitCircle.x[i + 1];
+    return Fix16::fromRaw(x0 + static_cast<int32_t>((static_cast<int64_t>(x1 - x0) * weight) >> 16));
+}
+
+// Number type of the ball physics, and of the time the ball moves for
+#if PONG_FIXED_POINT
+typedef Fix16 real_t;
+typedef StepTime step_t;
+#else
+typedef float real_t;
+typedef float step_t;
+#endif
+
+inline int realToInt(float x){ return static_cast<int>(x); }
+inline int realToInt(Fix16 x){ return x.raw < 0 ? -((-x.raw) >> 16) : x.toInt(); } // Truncates like the float cast
+inline float realToFloat(float x){ return x; }
+inline float realToFloat(Fix16 x){ return x.toFloat(); }
+
+#endif
@@ -0,0 +1,278 @@
+/* Copyright 2023 Collin Bollinger
+ *
+ * host/hal_shim.cpp
+ *
+ * Implementation of the mbed stand-ins declared in host/mbed.h
+ */
+
+#include "mbed.h"
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+GPIO_TypeDef host_gpioc;
+
+// Virtual clock
+static std::atomic<uint64_t> now_ns(0);
+
+// Pin values. Analog inputs rest at mid scale and digital inputs are pulled up
+static std::atomic<float> analog_values[HOST_PIN_COUNT];
+static std::atomic<int> digital_values[HOST_PIN_COUNT];
+
+// A scripted pin change
+struct ScriptEvent {
+    uint64_t at_ns;
+    PinName pin;
+    bool analog;
+    float value;
+};
+
+static std::mutex script_mtx;
+static std::vector<ScriptEvent> script; // Sorted by at_ns, latest first so due events pop off the back
+
+// GPIO recording
+static uint64_t gpio_counts[HOST_GPIO_REGISTERS];
+static void (*gpio_sink)(const HostGpioWrite &write, void *context) = nullptr;
+static void *gpio_sink_context = nullptr;
+
+// Registered interrupt sources. Function local so that global InterruptIn and Ticker objects can register themselves
+// whatever order the static constructors run in
+struct HostInterrupts {
+    static std::vector<InterruptIn*> &pins(){ static std::vector<InterruptIn*> list; return list; }
+    static std::vector<Ticker*> &tickers(){ static std::vector<Ticker*> list; return list; }
+
+    static void pin_changed(PinName pin, int value){
+        for (InterruptIn *in : pins()) {
+            std::function<void()> &handler = value ? in->_rise : in->_fall;
+            if (in->_pin == pin && handler) handler();
+        }
+    }
+
+    // Earliest time a ticker is due, or UINT64_MAX
+    static uint64_t next_tick(){
+        uint64_t next = UINT64_MAX;
+        for (Ticker *ticker : tickers()) next = std::min(next, ticker->_next_ns);
+        return next;
+    }
+
+    // By index, since a handler can attach or detach tickers. One that gets skipped over runs on the next pass
+    static void run_tickers(uint64_t now){
+        std::vector<Ticker*> &list = tickers();
+        for (size_t i = 0; i < list.size(); i++) {
+            Ticker *ticker = list[i];
+            if (ticker->_next_ns > now) continue;
+            ticker->_next_ns += ticker->_period_ns;
+            std::function<void()> func = ticker->_func; // The handler may attach this ticker again
+            if (ticker->_once) list.erase(list.begin() + i--);
+            func();
+        }
+    }
+
+    static void restart_tickers(){
+        for (Ticker *ticker : tickers()) ticker->_next_ns = ticker->_period_ns;
+    }
+};
+
+static bool in_handler = false;
+
+static void set_digital(PinName pin, int value){
+    if (digital_values[pin].exchange(value) != value) HostInterrupts::pin_changed(pin, value);
+}
+
+static void reset_pins(){
+    for (int i = 0; i < HOST_PIN_COUNT; i++) {
+        analog_values[i] = 0.5f;
+        digital_values[i] = 1;
+    }
+}
+
+// Runs before main so that pins have their idle values without the harness calling host_reset()
+static struct PinInitializer { PinInitializer() { reset_pins(); } } pin_initializer;
+
+uint64_t host_time_ns(){ return now_ns.load(); }
+
+void host_advance_ns(uint64_t ns){
+
+    uint64_t target = now_ns.load() + ns;
+
+    // Time passing inside a handler doesn't run other handlers. They catch up once the outer call gets to them
+    if (in_handler) { now_ns = target; return; }
+    in_handler = true;
+
+    // Step the clock from one due script event or ticker to the next, so that each sees the time it was due at
+    for (;;) {
+        uint64_t next = HostInterrupts::next_tick();
+        ScriptEvent event;
+        bool scripted = false;
+        {
+            std::lock_guard<std::mutex> lock(script_mtx);
+            if (!script.empty() && script.back().at_ns <= next) {
+                event = script.back();
+                next = event.at_ns;
+                scripted = true;
+            }
+            if (next > target) break;
+            if (scripted) script.pop_back();
+        }
+
+        if (next > now_ns.load()) now_ns = next;
+
+        if (!scripted) HostInterrupts::run_tickers(now_ns.load());
+        else if (event.analog) analog_values[event.pin] = event.value;
+        else set_digital(event.pin, static_cast<int>(event.value));
+    }
+
+    now_ns = target;
+    in_handler = false;
+}
+
+void host_reset(){
+    now_ns = 0;
+    reset_pins();
+    {
+        std::lock_guard<std::mutex> lock(script_mtx);
+        script.clear();
+    }
+    memset(&host_gpioc, 0, sizeof(host_gpioc));
+    host_gpio_clear_counts();
+    HostInterrupts::restart_tickers();
+}
+
+void host_set_analog(PinName pin, float value){ analog_values[pin] = value < 0 ? 0 : (value > 1 ? 1 : value); }
+
+void host_set_digital(PinName pin, int value){ set_digital(pin, value ? 1 : 0); }
+
+static void schedule(const ScriptEvent &event){
+    std::lock_guard<std::mutex> lock(script_mtx);
+    // Keep the list sorted latest first. Events at the same time keep the order they were scheduled in
+    auto position = std::lower_bound(script.begin(), script.end(), event,
+        [](const ScriptEvent &a, const ScriptEvent &b) { return a.at_ns > b.at_ns; });
+    script.insert(position, event);
+}
+
+void host_script_analog(uint32_t at_ms, PinName pin, float value){
+    schedule({ at_ms * 1000000ull, pin, true, value < 0 ? 0 : (value > 1 ? 1 : value) });
+}
+
+void host_script_press(uint32_t at_ms, PinName pin, uint32_t hold_ms){
+    schedule({ at_ms * 1000000ull, pin, false, 0 });
+    schedule({ (at_ms + hold_ms) * 1000000ull, pin, false, 1 });
+}
+
+void HostGpioRegister::operator=(uint32_t v) volatile {
+
+    HostGpioRegister *reg = const_cast<HostGpioRegister*>(this);
+    GPIO_TypeDef *port = &host_gpioc;
+    uint8_t id = static_cast<uint8_t>(reg - &port->PDOR);
+
+    switch (id) {
+        case HOST_PDOR: port->PDOR.value = v; break;
+        case HOST_PSOR: port->PDOR.value |= v; break;
+        case HOST_PCOR: port->PDOR.value &= ~v; break;
+        case HOST_PTOR: port->PDOR.value ^= v; break;
+        default: reg->value = v; break;
+    }
+
+    gpio_counts[id]++;
+    if (gpio_sink) gpio_sink({ now_ns.load(), id, v, port->PDOR.value }, gpio_sink_context);
+}
+
+uint64_t host_gpio_write_count(HostGpioRegisterId reg){ return gpio_counts[reg]; }
+
+uint64_t host_gpio_total_writes(){
+    uint64_t total = 0;
+    for (int i = 0; i < HOST_GPIO_REGISTERS; i++) total += gpio_counts[i];
+    return total;
+}
+
+void host_gpio_clear_counts(){ memset(gpio_counts, 0, sizeof(gpio_counts)); }
+
+void host_gpio_set_sink(void (*sink)(const HostGpioWrite &write, void *context), void *context){
+    gpio_sink = sink;
+    gpio_sink_context = context;
+}
+
+static std::recursive_mutex critical_section;
+
+void core_util_critical_section_enter(){ critical_section.lock(); }
+
+void core_util_critical_section_exit(){ critical_section.unlock(); }
+
+void thread_sleep_for(uint32_t millisec){
+    host_advance_ns(millisec * 1000000ull);
+    std::this_thread::yield();
+}
+
+void wait_us(int us){ host_advance_ns(us * 1000ull); }
+
+uint32_t us_ticker_read(){ return static_cast<uint32_t>(now_ns.load() / 1000); }
+
+uint32_t SystemCoreClock = 48000000;
+
+HostSysTickType host_systick = { 7, 48000000 / 1000 - 1, {}, 0 };
+
+HostSysTickValue::operator uint32_t() const volatile {
+    uint64_t cycles = now_ns.load() * (SystemCoreClock / 1000000) / 1000;
+    uint32_t period = host_systick.LOAD + 1;
+    return host_systick.LOAD - static_cast<uint32_t>(cycles % period);
+}
+
+float AnalogIn::read(){ return analog_values[_pin]; }
+
+unsigned short AnalogIn::read_u16(){ return static_cast<unsigned short>(read() * 0xFFFF + 0.5f); }
+
+int DigitalIn::read(){ return digital_values[_pin]; }
+
+void analogin_init(analogin_t *obj, PinName pin){ obj->pin = pin; }
+
+uint16_t analogin_read_u16(analogin_t *obj){ return static_cast<uint16_t>(analog_values[obj->pin] * 0xFFFF + 0.5f); }
+
+InterruptIn::InterruptIn(PinName pin) : _pin(pin) { HostInterrupts::pins().push_back(this); }
+
+InterruptIn::~InterruptIn(){
+    std::vector<InterruptIn*> &pins = HostInterrupts::pins();
+    pins.erase(std::remove(pins.begin(), pins.end(), this), pins.end());
+}
+
+int InterruptIn::read(){ return digital_values[_pin]; }
+
+void Ticker::attach(std::function<void()> func, std::chrono::microseconds period){
+    detach();
+    _func = func;
+    _once = false;
+    _period_ns = period.count() * 1000ull;
+    _next_ns = now_ns.load() + _period_ns;
+    HostInterrupts::tickers().push_back(this);
+}
+
+void Ticker::detach(){
+    std::vector<Ticker*> &tickers = HostInterrupts::tickers();
+    tickers.erase(std::remove(tickers.begin(), tickers.end(), this), tickers.end());
+}
+
+uint64_t Timer::elapsed_ns() const { return _accumulated_ns + (_running ? now_ns.load() - _start_ns : 0); }
+
+void Timer::start(){
+    if (_running) return;
+    _start_ns = now_ns.load();
+    _running = true;
+}
+
+void Timer::stop(){
+    _accumulated_ns = elapsed_ns();
+    _running = false;
+}
+
+void Timer::reset(){
+    _accumulated_ns = 0;
+    _start_ns = now_ns.load();
+}
+
+float Timer::read(){ return elapsed_ns() / 1e9f; }
+
+int Timer::read_ms(){ return static_cast<int>(elapsed_ns() / 1000000); }
+
+int Timer::read_us(){ return static_cast<int>(elapsed_ns() / 1000); }
+
+uint64_t Timer::read_high_resolution_us(){ return elapsed_ns() / 1000; }
@@ -0,0 +1,291 @@
+/* Copyright 2023 Collin Bollinger
+ *
+ * host/mbed.h
+ *
+ * Linux stand-ins for the parts of mbed-os used by the pong game. Only compiled by the host build (host/Makefile),
+ * which puts this directory in front of the include path so that "mbed.h" resolves here instead of mbed-os.
+ */
+
+#ifndef HOST_MBED_H
+#define HOST_MBED_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Pin names follow the KL25Z layout: port number in bits 5+ and pin number in bits 0-4
+#define HOST_PIN(port, pin) (((port) << 5) | (pin))
+#define HOST_PIN_COUNT (5 * 32)
+
+enum PinName {
+    PTA0 = HOST_PIN(0, 0), PTA1, PTA2, PTA3, PTA4, PTA5, PTA12 = HOST_PIN(0, 12), PTA13,
+    PTB0 = HOST_PIN(1, 0), PTB1, PTB2, PTB3,
+    PTC0 = HOST_PIN(2, 0), PTC1, PTC2, PTC3, PTC4, PTC5, PTC6, PTC7, PTC8, PTC9, PTC10, PTC11, PTC12, PTC13,
+    PTD0 = HOST_PIN(3, 0), PTD1, PTD2, PTD3, PTD4, PTD5,
+    PTE0 = HOST_PIN(4, 0), PTE1, PTE20 = HOST_PIN(4, 20), PTE21, PTE22, PTE23,
+    NC = -1
+};
+
+enum PinMode { PullNone, PullUp, PullDown, PullDefault = PullUp };
+
+enum osPriority {
+    osPriorityIdle = 1,
+    osPriorityLow = 8,
+    osPriorityBelowNormal = 16,
+    osPriorityNormal = 24,
+    osPriorityAboveNormal = 32,
+    osPriorityHigh = 40,
+    osPriorityRealtime = 48
+};
+
+enum osStatus { osOK = 0, osError = -1 };
+
+#define OS_STACK_SIZE 4096
+
+/* ---- Virtual clock ----
+ * Time only moves when something advances it: thread_sleep_for(), wait_us() or the harness calling host_advance_ns().
+ * Scripted pin changes are applied as the clock passes their timestamp. Ticker, Timeout and InterruptIn handlers run
+ * inside host_advance_ns() at the virtual time they are due, on the thread that moved the clock. Like interrupts at
+ * one priority, a handler is never interrupted by another one. */
+
+/* Current virtual time in nanoseconds */
+uint64_t host_time_ns();
+
+/* Moves the virtual clock forward and applies every scripted pin change that became due */
+void host_advance_ns(uint64_t ns);
+
+/* Resets the virtual clock, the pin values, the scripts and the GPIO counters */
+void host_reset();
+
+/* ---- Scriptable inputs ---- */
+
+/* Sets the value returned by AnalogIn::read() for pin, clamped to [0, 1] */
+void host_set_analog(PinName pin, float value);
+
+/* Sets the level returned by DigitalIn::read() for pin. Every digital input idles high (pulled up) */
+void host_set_digital(PinName pin, int value);
+
+/* Schedules host_set_analog(pin, value) at virtual time at_ms */
+void host_script_analog(uint32_t at_ms, PinName pin, float value);
+
+/* Schedules an active low button press on pin at virtual time at_ms, released again after hold_ms */
+void host_script_press(uint32_t at_ms, PinName pin, uint32_t hold_ms = 50);
+
+/* ---- GPIO port recording ---- */
+
+enum HostGpioRegisterId { HOST_PDOR, HOST_PSOR, HOST_PCOR, HOST_PTOR, HOST_PDIR, HOST_PDDR, HOST_GPIO_REGISTERS };
+
+// One register write as seen by the fake port
+struct HostGpioWrite {
+    uint64_t time_ns; // Virtual time of the write
+    uint8_t reg;      // HostGpioRegisterId written
+    uint32_t value;   // Value written
+    uint32_t pdor;    // Port output state after the write
+};
+
+// Register of the fake port. Assigning to it records the write and updates the port output state
+struct HostGpioRegister {
+    uint32_t value;
+
+    void operator=(uint32_t v) volatile;
+    operator uint32_t() const volatile { return value; }
+};
+
+// Same layout as the KL25Z GPIO register block
+typedef struct {
+    HostGpioRegister PDOR; // GPIO output data
+    HostGpioRegister PSOR; // Set PDOR bits
+    HostGpioRegister PCOR; // Clear PDOR bits
+    HostGpioRegister PTOR; // Toggle PDOR bits
+    HostGpioRegister PDIR; // Data in from GPIO
+    HostGpioRegister PDDR; // Specifies pins as I/O
+} GPIO_TypeDef;
+
+// The port C block the matrix driver writes to in the host build
+extern GPIO_TypeDef host_gpioc;
+
+/* Number of writes to register reg since the last host_gpio_clear_counts() */
+uint64_t host_gpio_write_count(HostGpioRegisterId reg);
+
+/* Sum of host_gpio_write_count() over every register */
+uint64_t host_gpio_total_writes();
+
+void host_gpio_clear_counts();
+
+/* Streams every port write to sink (nullptr to stop). Used for logging and decoding the scan protocol */
+void host_gpio_set_sink(void (*sink)(const HostGpioWrite &write, void *context), void *context);
+
+/* ---- mbed API stand-ins ---- */
+
+/* Interrupts are already held off while a handler runs, so the critical section only has to keep host threads apart */
+void core_util_critical_section_enter();
+void core_util_critical_section_exit();
+
+void thread_sleep_for(uint32_t millisec);
+void wait_us(int us);
+
+/* Free running microsecond counter (hal/us_ticker_api.h), wraps every 2^32 us */
+uint32_t us_ticker_read();
+
+// Core clock of the KL25Z, and the SysTick timer counting it down once per 1 ms RTOS tick
+extern uint32_t SystemCoreClock;
+
+// SysTick current value register, derived from the virtual clock
+struct HostSysTickValue {
+    operator uint32_t() const volatile;
+};
+
+typedef struct {
+    uint32_t CTRL;
+    uint32_t LOAD;
+    HostSysTickValue VAL;
+    uint32_t CALIB;
+} HostSysTickType;
+
+extern HostSysTickType host_systick;
+#define SysTick (&host_systick)
+
+class AnalogIn {
+public:
+    AnalogIn(PinName pin) : _pin(pin) {}
+    float read();
+    unsigned short read_u16();
+    operator float() { return read(); }
+
+private:
+    PinName _pin;
+};
+
+// HAL analog input, which the game uses from interrupt handlers where AnalogIn can't be used
+typedef struct analogin_s { PinName pin; } analogin_t;
+void analogin_init(analogin_t *obj, PinName pin);
+uint16_t analogin_read_u16(analogin_t *obj);
+
+class DigitalIn {
+public:
+    DigitalIn(PinName pin) : _pin(pin) {}
+    DigitalIn(PinName pin, PinMode) : _pin(pin) {}
+    int read();
+    void mode(PinMode) {}
+    operator int() { return read(); }
+
+private:
+    PinName _pin;
+};
+
+class DigitalOut {
+public:
+    DigitalOut(PinName pin, int value = 0) : _pin(pin), _value(value) {}
+    void write(int value) { _value = value; }
+    int read() { return _value; }
+    DigitalOut &operator=(int value) { write(value); return *this; }
+    operator int() { return read(); }
+
+private:
+    PinName _pin;
+    int _value;
+};
+
+// Calls its handlers when the virtual pin value changes, from host_advance_ns() or host_set_digital()
+class InterruptIn {
+public:
+    InterruptIn(PinName pin);
+    InterruptIn(PinName pin, PinMode) : InterruptIn(pin) {}
+    ~InterruptIn();
+    int read();
+    void mode(PinMode) {}
+    void rise(std::function<void()> func) { _rise = func; }
+    void fall(std::function<void()> func) { _fall = func; }
+    operator int() { return read(); }
+
+private:
+    friend struct HostInterrupts;
+    PinName _pin;
+    std::function<void()> _rise, _fall;
+};
+
+// Periodic handler on the virtual clock
+class Ticker {
+public:
+    ~Ticker() { detach(); }
+    void attach(std::function<void()> func, std::chrono::microseconds period);
+    void detach();
+
+protected:
+    bool _once = false; // Detached after its first call, for Timeout
+
+private:
+    friend struct HostInterrupts;
+    std::function<void()> _func;
+    uint64_t _period_ns = 0;
+    uint64_t _next_ns = 0;
+};
+
+// One shot handler on the virtual clock. Can be attached again from its own handler or another one
+class Timeout : public Ticker {
+public:
+    void attach(std::function<void()> func, std::chrono::microseconds delay) { Ticker::attach(func, delay); _once = true; }
+};
+
+// Timer reading the virtual clock
+class Timer {
+public:
+    void start();
+    void stop();
+    void reset();
+    float read();
+    int read_ms();
+    int read_us();
+    uint64_t read_high_resolution_us();
+
+private:
+    uint64_t elapsed_ns() const;
+
+    bool _running = false;
+    uint64_t _start_ns = 0;
+    uint64_t _accumulated_ns = 0;
+};
+
+// rtos::Mutex is recursive, so the stand-in is too
+class Mutex {
+public:
+    void lock() { _mutex.lock(); }
+    void unlock() { _mutex.unlock(); }
+    bool trylock() { return _mutex.try_lock(); }
+
+private:
+    std::recursive_mutex _mutex;
+};
+
+template <typename Lockable>
+class ScopedLock {
+public:
+    ScopedLock(Lockable &lockable) : _lockable(lockable) { _lockable.lock(); }
+    ~ScopedLock() { _lockable.unlock(); }
+
+private:
+    Lockable &_lockable;
+};
+
+class Thread {
+public:
+    Thread(osPriority priority = osPriorityNormal, uint32_t stack_size = OS_STACK_SIZE,
+           unsigned char *stack_mem = nullptr, const char *name = nullptr)
+        : _name(name) { (void)priority; (void)stack_size; (void)stack_mem; }
+    ~Thread() { if (_thread.joinable()) _thread.detach(); }
+
+    osStatus start(std::function<void()> task) { _thread = std::thread(task); return osOK; }
+    osStatus join() { if (_thread.joinable()) _thread.join(); return osOK; }
+    const char *get_name() const { return _name; }
+
+private:
+    const char *_name;
+    std::thread _thread;
+};
+
+#endif
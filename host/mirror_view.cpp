@@ -0,0 +1,234 @@
+/* Copyright 2023 Collin Bollinger
+ *
+ * host/mirror_view.cpp
+ *
+ * Decodes the frame mirror (see mirror.h) from a capture of the serial port, or live from a pseudo terminal that
+ * pong_host_mirror writes to in place of the serial port. Anything between packets, like printf output or trace
+ * dumps, is skipped by looking for the packet magic, and packets with a bad sum are dropped. Every packet is applied
+ * to the frame the viewer holds, which can be shown on the terminal and written out as PPM images or raw video. At the
+ * end it prints the packet counts, the bytes per packet and the hash of the last frame, which is the same as the
+ * "mirror frame hash" pong_host_mirror prints if nothing was lost.
+ *
+ * Usage: mirror_view [--pty LINKFILE] [--show] [--ppm PREFIX] [--raw FILE] [FILE]
+ *   --pty LINKFILE  Read from a new pseudo terminal and write the path of its other end to LINKFILE, for
+ *                   pong_host_mirror --mirror. Stops when the writer closes it
+ *   --show          Draw every frame on the terminal, one letter per pixel
+ *   --ppm PREFIX    Write every frame to PREFIXnnnnn.ppm
+ *   --raw FILE      Write every frame to FILE as raw 8 bit RGB video
+ *   FILE            Capture to decode (default stdin), e.g. from: cat /dev/ttyACM0 > capture.bin
+ */
+
+#include "mirror.h"
+#include "scan_decoder.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include <vector>
+
+struct MirrorView {
+    uint8_t colors[HEIGHT_PX][WIDTH_PX] = {};
+    uint32_t packets = 0, keyframes = 0, rows = 0;
+    uint64_t bytes = 0;
+    uint32_t largest = 0;
+    uint32_t bad_sums = 0, lost = 0;
+    uint64_t skipped = 0; // Bytes that weren't part of a packet
+    bool have_sequence = false;
+    uint16_t sequence = 0;
+
+    bool show = false;
+    const char *ppm_prefix = nullptr;
+    FILE *raw = nullptr;
+};
+
+// Frame hash as mirror_frame_hash() computes it
+static uint32_t frame_hash(const MirrorView &view){
+    uint32_t hash = 2166136261u;
+    for (uint8_t y = 0; y < HEIGHT_PX; y++) {
+        uint32_t row = mirror_row_hash(view.colors[y]);
+        for (uint8_t b = 0; b < 4; b++) { hash ^= row >> (8 * b) & UINT8_MAX; hash *= 16777619u; }
+    }
+    return hash;
+}
+
+static void output_frame(MirrorView &view, size_t packet_bytes){
+    static ScanFrame frame;
+    for (uint8_t y = 0; y < HEIGHT_PX; y++) {
+        for (uint8_t x = 0; x < WIDTH_PX; x++) {
+            uint8_t color = view.colors[y][x];
+            frame.rgb[y][x][0] = color & COLOR_RED ? 255 : 0;
+            frame.rgb[y][x][1] = color & COLOR_GREEN ? 255 : 0;
+            frame.rgb[y][x][2] = color & COLOR_BLUE ? 255 : 0;
+        }
+    }
+    if (view.raw) fwrite(frame.rgb, sizeof(frame.rgb), 1, view.raw);
+    if (view.ppm_prefix) {
+        char path[512];
+        snprintf(path, sizeof(path), "%s%05u.ppm", view.ppm_prefix, view.packets - 1);
+        if (!scan_frame_write_ppm(frame, path)) { perror(path); exit(2); }
+    }
+    if (view.show) {
+        // Home the cursor and draw over the last frame
+        static const char letters[8] = { '.', 'G', 'B', 'T', 'R', 'Y', 'M', 'W' };
+        printf("\033[H");
+        for (uint8_t y = 0; y < HEIGHT_PX; y++) {
+            for (uint8_t x = 0; x < WIDTH_PX; x++) putchar(letters[view.colors[y][x]]);
+            putchar('\n');
+        }
+        printf("packet %u, %zu bytes\n", view.sequence, packet_bytes);
+        fflush(stdout);
+    }
+}
+
+/* Decodes the packet at the start of data. Returns its size, 0 if data holds only the start of one, or -1 if it isn't
+ * a packet */
+static long decode_packet(MirrorView &view, const uint8_t *data, size_t size){
+
+    MirrorHeader header;
+    if (size < sizeof(header)) return 0;
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != MIRROR_MAGIC) return -1;
+    if (header.version != MIRROR_VERSION || header.width != WIDTH_PX || header.height != HEIGHT_PX || header.rows > HEIGHT_PX) {
+        fprintf(stderr, "packet with an unknown layout (version %u, %ux%u)\n", header.version, header.width, header.height);
+        return -1;
+    }
+
+    // Walk the rows to find the end before anything is applied
+    size_t at = sizeof(header);
+    uint16_t sum = 0;
+    for (uint8_t r = 0; r < header.rows; r++) {
+        if (at >= size) return 0;
+        if (data[at] >= HEIGHT_PX) return -1;
+        sum += data[at++];
+        for (uint16_t x = 0; x < WIDTH_PX;) {
+            if (at >= size) return 0;
+            sum += data[at];
+            x += (data[at++] >> 3) + 1;
+            if (x > WIDTH_PX) return -1;
+        }
+    }
+    if (at + 2 > size) return 0;
+    if ((data[at] | data[at + 1] << 8) != sum) {
+        view.bad_sums++;
+        return -1;
+    }
+    at += 2;
+
+    for (size_t p = sizeof(header); p < at - 2;) {
+        uint8_t y = data[p++];
+        for (uint8_t x = 0; x < WIDTH_PX; p++) {
+            uint8_t run = (data[p] >> 3) + 1;
+            memset(&view.colors[y][x], data[p] & 7, run);
+            x += run;
+        }
+    }
+
+    if (view.have_sequence) view.lost += static_cast<uint16_t>(header.sequence - view.sequence - 1);
+    view.have_sequence = true;
+    view.sequence = header.sequence;
+    view.packets++;
+    if (header.flags & MIRROR_KEYFRAME) view.keyframes++;
+    view.rows += header.rows;
+    view.bytes += at;
+    if (at > view.largest) view.largest = at;
+    output_frame(view, at);
+    return at;
+}
+
+// Decodes every whole packet in data and drops what was used
+static void decode(MirrorView &view, std::vector<uint8_t> &data){
+    size_t at = 0;
+    while (at < data.size()) {
+        long used = decode_packet(view, &data[at], data.size() - at);
+        if (used == 0) break;
+        if (used < 0) {
+            view.skipped++;
+            at++;
+        } else {
+            at += used;
+        }
+    }
+    data.erase(data.begin(), data.begin() + at);
+}
+
+/* Opens a pseudo terminal in raw mode and writes the path of its slave end to link_path. Returns the master end to
+ * read from, and the slave end the viewer holds open in slave */
+static int open_pty(const char *link_path, int *slave){
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) || unlockpt(master)) { perror("posix_openpt"); exit(2); }
+    const char *slave_path = ptsname(master);
+
+    // The slave is held open until the writer has opened it too, or reads would fail with EIO before it starts. Raw
+    // mode, so no newline is turned into two bytes
+    *slave = open(slave_path, O_RDWR | O_NOCTTY);
+    struct termios settings;
+    if (*slave < 0 || tcgetattr(*slave, &settings)) { perror(slave_path); exit(2); }
+    cfmakeraw(&settings);
+    tcsetattr(*slave, TCSANOW, &settings);
+
+    // Written under another name and renamed, so that a script waiting for the file never reads half of it
+    char temp_path[512];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", link_path);
+    FILE *link = fopen(temp_path, "w");
+    if (!link) { perror(temp_path); exit(2); }
+    fprintf(link, "%s\n", slave_path);
+    fclose(link);
+    if (rename(temp_path, link_path)) { perror(link_path); exit(2); }
+    return master;
+}
+
+int main(int argc, char **argv){
+
+    static MirrorView view;
+    const char *link_path = nullptr;
+    int in = STDIN_FILENO;
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (!strcmp(arg, "--show")) view.show = true;
+        else if (!strcmp(arg, "--pty") && value) { link_path = value; i++; }
+        else if (!strcmp(arg, "--ppm") && value) { view.ppm_prefix = value; i++; }
+        else if (!strcmp(arg, "--raw") && value) { if (!(view.raw = fopen(value, "wb"))) { perror(value); return 2; } i++; }
+        else if (arg[0] == '-') { fprintf(stderr, "bad argument %s\n", arg); return 2; }
+        else if ((in = open(arg, O_RDONLY)) < 0) { perror(arg); return 2; }
+    }
+
+    int slave = -1;
+    if (link_path) in = open_pty(link_path, &slave);
+    if (view.show) printf("\033[2J");
+
+    std::vector<uint8_t> data;
+    uint8_t chunk[4096];
+    while (true) {
+        // The pty is given 30 s for the writer to start
+        if (slave >= 0) {
+            struct pollfd wait = { in, POLLIN, 0 };
+            if (poll(&wait, 1, 30000) <= 0) { fprintf(stderr, "nothing was written to the pty\n"); return 1; }
+        }
+        ssize_t got = read(in, chunk, sizeof(chunk));
+        if (got < 0 && errno == EINTR) continue;
+        // A pty master reads EIO once no one has the slave open
+        if (got <= 0) break;
+
+        // Now that the writer has it open, the viewer's own slave is let go so that the writer closing it ends the read
+        if (slave >= 0) {
+            close(slave);
+            slave = -1;
+        }
+        data.insert(data.end(), chunk, chunk + got);
+        decode(view, data);
+    }
+    view.skipped += data.size();
+    if (view.raw) fclose(view.raw);
+
+    printf("packets:            %u, %u keyframes, %u lost, %u bad sums\n", view.packets, view.keyframes, view.lost, view.bad_sums);
+    if (view.packets) {
+        printf("bytes per packet:   %.1f mean, %u largest (%.1f rows)\n", (double)view.bytes / view.packets,
+               view.largest, (double)view.rows / view.packets);
+    }
+    printf("skipped bytes:      %llu\n", (unsigned long long)view.skipped);
+    printf("mirror frame hash:  %08x\n", frame_hash(view));
+    return view.packets ? 0 : 1;
+}
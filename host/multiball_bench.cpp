@@ -0,0 +1,73 @@
+/* Copyright 2023 Collin Bollinger
+ *
+ * host/multiball_bench.cpp
+ *
+ * Times the multi-ball engine (multiball.h) at doubling ball counts: the batched update every tick, writing the pixel
+ * layer every tick and drawing it into a frame buffer once per displayed frame. From those it works out the share of
+ * a core the balls would take at SIM_STEP_US ticks and SCAN_REFRESH_HZ frames, and reports the most balls that stay
+ * within MULTIBALL_BUDGET_PERCENT. Built with MULTIBALL_MAX=4096 (the multi variant), so it shows how far the host
+ * scales. On the device, the stress ramp in multiball_tick() does the same with SysTick cycles.
+ *
+ * Usage: multiball_bench [--ticks N]
+ */
+
+#include "multiball.h"
+
+#include <chrono>
+
+int main(int argc, char **argv){
+
+    uint32_t ticks = 5000;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!strcmp(argv[i], "--ticks")) ticks = strtoul(argv[i + 1], nullptr, 0);
+    }
+    if (ticks == 0) ticks = 1;
+
+    using clock = std::chrono::steady_clock;
+    const uint32_t ticks_per_frame = 1000000 / SIM_STEP_US / SCAN_REFRESH_HZ;
+    static port_word_t rows[SCAN_ROWS][WIDTH_PX];
+
+    printf("%8s %12s %10s %12s %12s %8s\n", "balls", "update ns", "ns/ball", "publish ns", "draw ns", "cpu");
+
+    uint32_t sustained = 0;
+    for (uint32_t count = 1; count <= MULTIBALL_MAX; count *= 2) {
+
+        host_reset();
+        simulation_init();
+        multiball_init(game, count);
+        multiballRamping = false;
+
+        clock::duration update_time(0), publish_time(0), draw_time(0);
+        uint32_t frames = 0, torn = 0;
+        GameSnapshot snapshot = {};
+        for (uint32_t tick = 0; tick < ticks; tick++) {
+            clock::time_point begin = clock::now();
+            multiball_update(game);
+            clock::time_point updated = clock::now();
+            multiball_publish(snapshot);
+            clock::time_point published = clock::now();
+            update_time += updated - begin;
+            publish_time += published - updated;
+
+            if (tick % ticks_per_frame == 0) {
+                memset(rows, 0, sizeof(rows));
+                begin = clock::now();
+                if (!multiball_draw(rows, snapshot)) torn++;
+                draw_time += clock::now() - begin;
+                frames++;
+            }
+        }
+
+        double update_ns = std::chrono::duration<double, std::nano>(update_time).count() / ticks;
+        double publish_ns = std::chrono::duration<double, std::nano>(publish_time).count() / ticks;
+        double draw_ns = std::chrono::duration<double, std::nano>(draw_time).count() / frames;
+        double cpu = (update_ns + publish_ns + draw_ns / ticks_per_frame) / (SIM_STEP_US * 1000.0) * 100;
+        if (cpu <= MULTIBALL_BUDGET_PERCENT) sustained = count;
+
+        printf("%8u %12.0f %10.2f %12.0f %12.0f %7.2f%%%s\n", count, update_ns, update_ns / count, publish_ns, draw_ns, cpu,
+               torn ? " (torn draws)" : "");
+    }
+
+    printf("sustained:          %u balls within %d%% of a core\n", sustained, MULTIBALL_BUDGET_PERCENT);
+    return 0;
+}
@@ -0,0 +1,124 @@
+/* Copyright 2023 Collin Bollinger
+ *
+ * host/physics_bench.cpp
+ *
+ * Times simulation_step() in practice matches. Built twice by the host Makefile, as physics_bench_float and
+ * physics_bench_fixed (PONG_FIXED_POINT=1), so the two physics paths run the same workload. Every run is a match
+ * against the computer, started with the Pause/Play button, with the left slider played by a stand in that moves its
+ * paddle towards the ball at --player-speed rows per second. The ball is served, sped up by the paddles and missed,
+ * which exercises the bounce, speed and swept collision code as well as the per step integration.
+ *
+ * Before that it checks the per step integration on its own: a ball flying freely at a few speeds is moved the way
+ * updateBallState() moves it for a minute of steps, and its distance is compared with the exact one. The two builds
+ * print the same table, so their drift can be compared line by line.
+ *
+ * Usage: physics_bench [--runs N] [--ms N] [--player-speed ROWS]
+ */
+
+#include "pong.h"
+
+#include <chrono>
+
+// One match: its input source and virtual clock
+struct BenchMatch {
+    GameState game;
+    uint32_t now_us;
+    bool started;
+    float player_row; // Where the stand in player has moved the left paddle to
+    float player_speed; // Rows per second
+};
+
+static bool benchNextEvent(void *context, InputEvent &event){
+    BenchMatch *match = static_cast<BenchMatch*>(context);
+    if (match->started) return false;
+    match->started = true;
+    event = { INPUT_PAUSE, match->now_us };
+    return true;
+}
+
+// Sliders are read once per step, so the player moves a step's worth each time
+static uint16_t benchSlider(void *context, uint8_t slider){
+
+    BenchMatch *match = static_cast<BenchMatch*>(context);
+    const float top = HEIGHT_PX - PADDLE_HEIGHT;
+    if (slider != INPUT_LEFT) return UINT16_MAX / 2; // The computer plays the right paddle
+
+    float target = realToFloat(match->game.ball.y_pos) - PADDLE_HEIGHT / 2.0f;
+    float reach = match->player_speed * SIM_STEP_US / 1e6f;
+    float row = match->player_row;
+    row = target > row + reach ? row + reach : (target < row - reach ? row - reach : target);
+    match->player_row = row < 0 ? 0 : (row > top ? top : row);
+
+    // Inverse of readPaddleSlider()
+    return static_cast<uint16_t>(match->player_row / top * UINT16_MAX);
+}
+
+static uint32_t benchClock(void *context){ return static_cast<BenchMatch*>(context)->now_us; }
+
+// Distance a ball at velocity pixels per second covers in steps steps, moved like updateBallState() moves it
+static float flightDistance(double velocity, uint32_t steps){
+    const step_t d_t = SIM_STEP_US / 1000000.0;
+    real_t slope = velocity, pos = 0;
+    for (uint32_t i = 0; i < steps; i++) pos += d_t * slope;
+    return realToFloat(pos);
+}
+
+int main(int argc, char **argv){
+
+    int runs = 20;
+    uint32_t run_ms = 60000;
+    float player_speed = 15; // Slow enough that both sides miss now and then within a run
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!strcmp(argv[i], "--runs")) runs = atoi(argv[i + 1]);
+        else if (!strcmp(argv[i], "--ms")) run_ms = strtoul(argv[i + 1], nullptr, 0);
+        else if (!strcmp(argv[i], "--player-speed")) player_speed = atof(argv[i + 1]);
+    }
+
+    printf("physics:            %s\n", PONG_FIXED_POINT ? "Q16.16 fixed point" : "float");
+
+    // A minute of free flight. MAX_VELOCITY covers 15000 pixels in that, which still fits in Q16.16
+    const uint32_t flight_steps = 60000;
+    const double velocities[] = { BEGIN_VELOCITY, 37.5, 100.0, MAX_VELOCITY };
+    printf("flight of %u steps:  velocity, distance, exact distance, drift\n", flight_steps);
+    for (double velocity : velocities) {
+        float distance = flightDistance(velocity, flight_steps);
+        double exact = velocity * flight_steps * SIM_STEP_US / 1e6;
+        printf("  %8.1f px/s %12.4f px %12.4f px %+9.4f%%\n", velocity, distance, exact,
+               (distance - exact) / exact * 100);
+    }
+
+    using clock = std::chrono::steady_clock;
+    clock::duration step_time(0);
+    uint64_t steps = 0;
+    uint32_t points = 0;
+
+    for (int run = 0; run < runs; run++) {
+
+        // Every run is seeded differently
+        BenchMatch match = {};
+        match.player_row = (HEIGHT_PX - PADDLE_HEIGHT) / 2.0f;
+        match.player_speed = player_speed;
+        GameIO io = { benchNextEvent, benchSlider, benchClock, &match };
+        game_init(match.game, io, defaultRules, run + 1);
+
+        for (uint32_t step = 0; step < run_ms * 1000 / SIM_STEP_US; step++) {
+            match.now_us += SIM_STEP_US;
+            clock::time_point begin = clock::now();
+            simulation_step(match.game);
+            publishSnapshot(match.game);
+            step_time += clock::now() - begin;
+            steps++;
+        }
+
+        points += match.game.score_left + match.game.score_right;
+    }
+
+    double step_ns = std::chrono::duration<double, std::nano>(step_time).count() / steps;
+
+    printf("steps:              %llu over %d runs of %u ms\n", (unsigned long long)steps, runs, run_ms);
+    printf("simulation_step():  %.1f ns/step\n", step_ns);
+    printf("points played:      %u\n", points);
+
+    return 0;
+}
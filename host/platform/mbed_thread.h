@@ -0,0 +1,13 @@
+/* Copyright 2023 Collin Bollinger
+ *
+ * host/platform/mbed_thread.h
+ *
+ * thread_sleep_for() is declared by the host mbed.h stand-in
+ */
+
+#ifndef HOST_MBED_THREAD_H
+#define HOST_MBED_THREAD_H
+
+#include "mbed.h"
+
+#endif
@@ -0,0 +1,184 @@
+/* Copyright 2023 Collin Bollinger
+ *
+ * host/pong_batch.cpp
+ *
+ * Plays thousands of headless practice matches against the computer player in parallel, one GameState per match,
+ * spread over every core. Used to tune the serve speed (BEGIN_VELOCITY), the speed gained per paddle bounce
+ * (BOUNCE_SPEEDUP) and the computer's difficulty: every combination of the listed values plays --games matches.
+ *
+ * Each match has its own input source and virtual clock. The Pause/Play button is pressed once to start it, and the
+ * left slider is played by a simple human stand in that moves its paddle towards the ball at --player-speed rows per
+ * second. Matches are simulated event driven, sleeping for simulation_sleep_ms() between steps, and end when either
+ * side has --points points or after --minutes of game time.
+ *
+ * Usage: pong_batch [--games N] [--threads N] [--points N] [--minutes N] [--player-speed ROWS]
+ *                   [--velocity LIST] [--speedup LIST] [--ai LIST]
+ *   LIST is comma separated, for example --velocity 10,20,40
+ */
+
+#include "pong.h"
+#include "pong_ai.h"
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+// Rules of one row of the report
+struct BatchRules {
+    float velocity;
+    float speedup;
+    uint8_t ai;
+};
+
+// One match: the game and everything its input source needs
+struct Match {
+    GameState game;
+    uint32_t now_us; // Virtual clock
+    bool started;
+    float player_row; // Where the stand in player has moved the left paddle to
+    uint32_t player_us; // Clock when the player last moved
+    float player_speed; // Rows per second
+};
+
+// Finished match
+struct MatchResult {
+    uint8_t score_left, score_right;
+    uint32_t ticks;
+};
+
+static bool matchNextEvent(void *context, InputEvent &event){
+    Match *match = static_cast<Match*>(context);
+    if (match->started) return false;
+    match->started = true;
+    event = { INPUT_PAUSE, match->now_us };
+    return true;
+}
+
+static uint16_t matchSlider(void *context, uint8_t slider){
+
+    Match *match = static_cast<Match*>(context);
+    const float top = HEIGHT_PX - PADDLE_HEIGHT;
+    if (slider != INPUT_LEFT) return UINT16_MAX / 2; // The computer plays the right paddle
+
+    // Move towards the ball, no faster than the player's speed
+    float target = static_cast<float>(match->game.ball.y_pos) - PADDLE_HEIGHT / 2.0f;
+    float reach = match->player_speed * (match->now_us - match->player_us) / 1e6f;
+    match->player_us = match->now_us;
+    float row = match->player_row;
+    row = target > row + reach ? row + reach : (target < row - reach ? row - reach : target);
+    match->player_row = row < 0 ? 0 : (row > top ? top : row);
+
+    // Inverse of readPaddleSlider()
+    return static_cast<uint16_t>(match->player_row / top * UINT16_MAX);
+}
+
+static uint32_t matchClock(void *context){ return static_cast<Match*>(context)->now_us; }
+
+static MatchResult playMatch(const BatchRules &rules, uint32_t seed, uint8_t points, uint32_t max_ticks,
+                             float player_speed){
+
+    Match match = {};
+    match.player_row = (HEIGHT_PX - PADDLE_HEIGHT) / 2.0f;
+    match.player_speed = player_speed;
+
+    GameIO io = { matchNextEvent, matchSlider, matchClock, &match };
+    GameRules game_rules = { rules.velocity, rules.speedup, rules.ai };
+    GameState &game = match.game;
+    game_init(game, io, game_rules, seed);
+
+    while (game.score_left < points && game.score_right < points && game.simulationTicks < max_ticks) {
+        simulation_step(game);
+        match.now_us += simulation_sleep_ms(game) * 1000;
+    }
+    return { game.score_left, game.score_right, game.simulationTicks };
+}
+
+// Comma separated numbers
+static std::vector<float> parseList(const char *text){
+    std::vector<float> values;
+    for (char *end; *text; text = *end ? end + 1 : end) {
+        values.push_back(strtof(text, &end));
+        if (end == text) return {};
+    }
+    return values;
+}
+
+int main(int argc, char **argv){
+
+    uint32_t games = 200;
+    uint32_t threads = std::thread::hardware_concurrency();
+    uint8_t points = 5;
+    uint32_t minutes = 10;
+    float player_speed = 40;
+    std::vector<float> velocities = { 10, 20, 40 }, speedups = { 1, 2, 4 }, ais = { AI_EASY, AI_NORMAL, AI_HARD, AI_PERFECT };
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        const char *value = argv[i + 1];
+        if (!strcmp(argv[i], "--games")) games = strtoul(value, nullptr, 0);
+        else if (!strcmp(argv[i], "--threads")) threads = strtoul(value, nullptr, 0);
+        else if (!strcmp(argv[i], "--points")) points = strtoul(value, nullptr, 0);
+        else if (!strcmp(argv[i], "--minutes")) minutes = strtoul(value, nullptr, 0);
+        else if (!strcmp(argv[i], "--player-speed")) player_speed = atof(value);
+        else if (!strcmp(argv[i], "--velocity")) velocities = parseList(value);
+        else if (!strcmp(argv[i], "--speedup")) speedups = parseList(value);
+        else if (!strcmp(argv[i], "--ai")) ais = parseList(value);
+        else { fprintf(stderr, "bad argument %s %s\n", argv[i], value); return 2; }
+    }
+    if (threads == 0) threads = 1;
+    if (games == 0 || points == 0 || velocities.empty() || speedups.empty() || ais.empty()) {
+        fprintf(stderr, "nothing to play\n");
+        return 2;
+    }
+
+    std::vector<BatchRules> table;
+    for (float velocity : velocities)
+        for (float speedup : speedups)
+            for (float ai : ais) {
+                if (ai < 0 || ai >= AI_DIFFICULTIES) { fprintf(stderr, "no ai difficulty %g\n", ai); return 2; }
+                table.push_back({ velocity, speedup, static_cast<uint8_t>(ai) });
+            }
+
+    // Every thread takes the next match until there are none left. Match i plays the rules in row i / games with
+    // seed i, so the results don't depend on the number of threads
+    uint32_t total = table.size() * games;
+    uint32_t max_ticks = minutes * 60 * 1000000 / SIM_STEP_US;
+    std::vector<MatchResult> results(total);
+    std::atomic<uint32_t> next(0);
+
+    using clock = std::chrono::steady_clock;
+    clock::time_point begin = clock::now();
+
+    std::vector<std::thread> workers;
+    for (uint32_t t = 0; t < threads; t++) {
+        workers.emplace_back([&]() {
+            for (uint32_t i; (i = next.fetch_add(1)) < total;)
+                results[i] = playMatch(table[i / games], i + 1, points, max_ticks, player_speed);
+        });
+    }
+    for (std::thread &worker : workers) worker.join();
+
+    double seconds = std::chrono::duration<double>(clock::now() - begin).count();
+
+    printf("%8s %8s %8s %10s %12s %12s %10s\n", "velocity", "speedup", "ai", "player won", "points/game", "s/point",
+           "unfinished");
+    uint64_t all_ticks = 0;
+    for (size_t row = 0; row < table.size(); row++) {
+        uint32_t won = 0, played = 0, unfinished = 0;
+        uint64_t ticks = 0;
+        for (uint32_t i = row * games; i < (row + 1) * games; i++) {
+            const MatchResult &result = results[i];
+            won += result.score_left >= points;
+            unfinished += result.score_left < points && result.score_right < points;
+            played += result.score_left + result.score_right;
+            ticks += result.ticks;
+        }
+        all_ticks += ticks;
+        printf("%8g %8g %8u %9.1f%% %12.2f %12.2f %10u\n", table[row].velocity, table[row].speedup, table[row].ai,
+               100.0 * won / games, (double)played / games, played ? ticks * SIM_STEP_US / 1e6 / played : 0.0,
+               unfinished);
+    }
+
+    printf("matches:            %u on %u threads in %.2f s\n", total, threads, seconds);
+    printf("games per second:   %.0f (%.1f million ticks per second)\n", total / seconds, all_ticks / seconds / 1e6);
+    return 0;
+}
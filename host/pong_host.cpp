@@ -0,0 +1,373 @@
+/* Copyright 2023 Collin Bollinger
+ *
+ * host/pong_host.cpp
+ *
+ * Headless runner for the host build. Interleaves simulation_step() and rgb_matrix_frame() (or rgb_matrix_render()
+ * with the row interrupt scanning, see SCAN_INTERRUPT) on the virtual clock the same way the two device threads do,
+ * drives the sliders and buttons from a script given on the command line, and reports how long the game code took in
+ * real (wall clock) time and the frames and row timing decoded from the port. Built with EXECUTIVE_ENABLED
+ * (pong_host_exec) it runs the executive's loop instead, which scans paced frames and fits the simulation steps and
+ * scene drawing into the idle part of every row slot, so the two modes can be compared on the same script.
+ *
+ * Usage: pong_host [--ms N] [--ticks N] [--jitter MS] [--event-driven] [--frame-every N] [--start MS] [--left V]
+ *                  [--right V] [--press PIN@MS] [--slide PIN=V@MS] [--ai N] [--trace FILE]
+ *                  [--record FILE] [--raw FILE] [--ppm PREFIX] [--refresh HZ] [--brightness N] [--wiggle PIN=MS]
+ *                  [--mirror FILE]
+ *   --ms N           Virtual milliseconds to run (default 10000)
+ *   --ticks N        Run until the simulation has done N fixed ticks instead
+ *   --jitter MS      Sleep a random 1 to MS virtual milliseconds between steps instead of exactly 1, like a busy
+ *                    scheduler would. The state hash after --ticks N is the same for any jitter as long as the
+ *                    inputs only change at times the simulation is not held up
+ *   --event-driven   Sleep for simulation_sleep_ms() between steps, like simulate() with eventDrivenSimulation set.
+ *                    Compare the wakeups per second with and without it
+ *   --frame-every N  Scan one matrix frame (or draw the latest scene) every N virtual milliseconds (default 1)
+ *   --start MS       Press the Pause/Play button at MS to start the game (default 100, -1 to stay on the title screen)
+ *   --left V         Initial left slider value in [0, 1]
+ *   --right V        Initial right slider value in [0, 1]
+ *   --press PIN@MS   Press a button (reset, pause or player) at MS
+ *   --slide PIN=V@MS Move a slider (left or right) to V at MS
+ *   --wiggle PIN=MS  Move a slider between 0.25 and 0.75 every MS for the whole run, for the input latency trace
+ *   --ai N           Difficulty of the computer's paddle in practice mode, 0 (easy) to 3 (perfect)
+ *   --trace FILE     Write a trace dump to FILE every TRACE_DUMP_MS and at the end, like the device does over serial.
+ *                    Only has data in builds with TRACE_ENABLED (pong_host_trace). Decode with trace_decode
+ *   --record FILE    Write the input recording to FILE at the end. Only in builds with RECORD_ENABLED
+ *                    (pong_host_record). Replay with pong_replay
+ *   --raw FILE       Write every frame decoded from the port (scan_decoder.h) to FILE as raw 8 bit RGB video
+ *   --ppm PREFIX     Write every decoded frame that differs from the one before to PREFIXnnnnn.ppm
+ *   --refresh HZ     Scan at HZ frames per second instead of SCAN_REFRESH_HZ
+ *   --brightness N   Scan at brightness N, 0 to 255, instead of SCAN_BRIGHTNESS
+ *   --mirror FILE    Send the frame mirror to FILE every MIRROR_PERIOD_MS, like the device does over serial. FILE can
+ *                    be the pty that mirror_view --pty made. Only in builds with MIRROR_ENABLED (pong_host_mirror)
+ */
+
+#include "pong.h"
+#include "multiball.h"
+#include "pong_ai.h"
+#include "input_record.h"
+#include "trace.h"
+#include "scan_decoder.h"
+#include "executive.h"
+#include "mirror.h"
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+
+// FNV-1a over the game state, to compare runs
+static uint64_t state_hash(){
+    uint64_t hash = 14695981039346656037ull;
+    auto add = [&hash](const void *data, size_t size) {
+        for (size_t i = 0; i < size; i++) { hash ^= static_cast<const uint8_t*>(data)[i]; hash *= 1099511628211ull; }
+    };
+    add(&game.ball.x_pos, sizeof(game.ball.x_pos));
+    add(&game.ball.y_pos, sizeof(game.ball.y_pos));
+    add(&game.ball.x_slope, sizeof(game.ball.x_slope));
+    add(&game.ball.y_slope, sizeof(game.ball.y_slope));
+    add(&game.leftPaddle.y_idx, 1);
+    add(&game.rightPaddle.y_idx, 1);
+    add(&game.score_left, 1);
+    add(&game.score_right, 1);
+    return hash;
+}
+
+// Decoded panel output: a hash of every frame, and the frames written to --raw and --ppm
+struct FrameCapture {
+    uint64_t hash = 14695981039346656037ull;
+    FILE *raw = nullptr;
+    const char *ppm_prefix = nullptr;
+    uint32_t ppm_frames = 0;
+    bool have_last = false;
+    uint8_t last[HEIGHT_PX][WIDTH_PX][3];
+};
+
+static void capture_frame(const ScanFrame &frame, void *context){
+    FrameCapture &capture = *static_cast<FrameCapture*>(context);
+    const uint8_t *pixels = &frame.rgb[0][0][0];
+    for (size_t i = 0; i < sizeof(frame.rgb); i++) { capture.hash ^= pixels[i]; capture.hash *= 1099511628211ull; }
+    if (capture.raw) fwrite(frame.rgb, sizeof(frame.rgb), 1, capture.raw);
+
+    // The panel repeats a scene for many frames, so only the ones that differ from the frame before are written
+    if (capture.ppm_prefix && !(capture.have_last && !memcmp(capture.last, frame.rgb, sizeof(frame.rgb)))) {
+        char path[512];
+        snprintf(path, sizeof(path), "%s%05u.ppm", capture.ppm_prefix, capture.ppm_frames++);
+        if (!scan_frame_write_ppm(frame, path)) { perror(path); exit(2); }
+    }
+    memcpy(capture.last, frame.rgb, sizeof(frame.rgb));
+    capture.have_last = true;
+}
+
+static FILE *trace_file = nullptr;
+
+static void write_trace(const void *data, size_t size){ fwrite(data, 1, size, trace_file); }
+
+static FILE *record_file = nullptr;
+#if RECORD_ENABLED
+static void write_record(const void *data, size_t size){ fwrite(data, 1, size, record_file); }
+#endif
+
+static FILE *mirror_file = nullptr;
+#if MIRROR_ENABLED
+static void write_mirror(const void *data, size_t size){ fwrite(data, 1, size, mirror_file); }
+#endif
+
+#if EXECUTIVE_ENABLED
+// The executive steps the game whenever a step is due, so for --ticks the game's clock stops once it has done enough
+static GameIO device_io;
+static uint32_t tick_limit = UINT32_MAX;
+static uint32_t stopped_us = 0;
+
+static uint32_t limited_clock(void *context){
+    if (game.simulationTicks < tick_limit) stopped_us = device_io.clockUs(context);
+    return stopped_us;
+}
+#endif
+
+static PinName pin_from_name(const char *name){
+    if (!strcmp(name, "reset")) return PTA1;
+    if (!strcmp(name, "pause")) return PTA2;
+    if (!strcmp(name, "player")) return PTD4;
+    if (!strcmp(name, "left")) return PTB0;
+    if (!strcmp(name, "right")) return PTB1;
+    fprintf(stderr, "unknown pin '%s'\n", name);
+    exit(2);
+}
+
+int main(int argc, char **argv){
+
+    uint32_t run_ms = 10000;
+    uint32_t run_ticks = 0;
+    uint32_t jitter_ms = 1;
+    uint32_t frame_every = 1;
+    int start_ms = 100;
+    int ai_difficulty = -1;
+    uint32_t refresh_hz = SCAN_REFRESH_HZ;
+    uint32_t brightness = SCAN_BRIGHTNESS;
+    static FrameCapture capture;
+    PinName wiggle_pins[INPUT_SLIDERS];
+    unsigned wiggle_ms[INPUT_SLIDERS];
+    uint8_t wiggles = 0;
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        if (!strcmp(arg, "--event-driven")) { eventDrivenSimulation = true; continue; }
+
+        const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (!value) { fprintf(stderr, "missing value for %s\n", arg); return 2; }
+        i++;
+
+        char name[16];
+        float level;
+        unsigned at;
+        if (!strcmp(arg, "--ms")) run_ms = strtoul(value, nullptr, 0);
+        else if (!strcmp(arg, "--ticks")) run_ticks = strtoul(value, nullptr, 0);
+        else if (!strcmp(arg, "--jitter")) jitter_ms = strtoul(value, nullptr, 0);
+        else if (!strcmp(arg, "--frame-every")) frame_every = strtoul(value, nullptr, 0);
+        else if (!strcmp(arg, "--start")) start_ms = atoi(value);
+        else if (!strcmp(arg, "--left")) host_set_analog(PTB0, atof(value));
+        else if (!strcmp(arg, "--right")) host_set_analog(PTB1, atof(value));
+        else if (!strcmp(arg, "--press") && sscanf(value, "%15[a-z]@%u", name, &at) == 2) host_script_press(at, pin_from_name(name));
+        else if (!strcmp(arg, "--ai") && strtoul(value, nullptr, 0) < AI_DIFFICULTIES) ai_difficulty = strtoul(value, nullptr, 0);
+        else if (!strcmp(arg, "--trace")) { if (!(trace_file = fopen(value, "wb"))) { perror(value); return 2; } }
+        else if (!strcmp(arg, "--record") && RECORD_ENABLED) { if (!(record_file = fopen(value, "wb"))) { perror(value); return 2; } }
+        else if (!strcmp(arg, "--mirror") && MIRROR_ENABLED) { if (!(mirror_file = fopen(value, "wb"))) { perror(value); return 2; } }
+        else if (!strcmp(arg, "--raw")) { if (!(capture.raw = fopen(value, "wb"))) { perror(value); return 2; } }
+        else if (!strcmp(arg, "--ppm")) capture.ppm_prefix = value;
+        else if (!strcmp(arg, "--refresh")) refresh_hz = strtoul(value, nullptr, 0);
+        else if (!strcmp(arg, "--brightness") && strtoul(value, nullptr, 0) <= UINT8_MAX) brightness = strtoul(value, nullptr, 0);
+        else if (!strcmp(arg, "--slide") && sscanf(value, "%15[a-z]=%f@%u", name, &level, &at) == 3) host_script_analog(at, pin_from_name(name), level);
+        else if (!strcmp(arg, "--wiggle") && wiggles < INPUT_SLIDERS && sscanf(value, "%15[a-z]=%u", name, &at) == 2 && at > 0) {
+            wiggle_pins[wiggles] = pin_from_name(name);
+            wiggle_ms[wiggles++] = at;
+        }
+        else { fprintf(stderr, "bad argument %s %s\n", arg, value); return 2; }
+    }
+    if (start_ms >= 0) host_script_press(start_ms, PTA2);
+    uint32_t script_ms = std::max<uint64_t>(run_ms, run_ticks * SIM_STEP_US / 1000);
+    for (uint8_t w = 0; w < wiggles; w++)
+        for (uint32_t at = wiggle_ms[w], n = 0; at < script_ms; at += wiggle_ms[w], n++) host_script_analog(at, wiggle_pins[w], n & 1 ? 0.25 : 0.75);
+    if (frame_every == 0) frame_every = 1;
+    if (jitter_ms == 0) jitter_ms = 1;
+
+    // Separate generator for the jitter so that the game's random sequence is untouched
+    std::minstd_rand jitter(12345);
+
+    using clock = std::chrono::steady_clock;
+    clock::duration simulation_time(0), frame_time(0);
+    uint32_t steps = 0, frames = 0;
+    uint64_t frame_virtual_ns = 0; // Virtual time spent inside rgb_matrix_frame(), from its timed waits
+
+    static ScanDecoder decoder;
+    decoder.sink = capture_frame;
+    decoder.sink_context = &capture;
+    host_gpio_set_sink(scan_decoder_write, &decoder);
+
+#if EXECUTIVE_ENABLED
+    executive_init();
+    if (run_ticks) {
+        device_io = game.io;
+        tick_limit = run_ticks;
+        game.io.clockUs = limited_clock;
+    }
+#else
+    simulation_init();
+    rgb_matrix_init();
+#endif
+    if (ai_difficulty >= 0) game.rules.aiDifficulty = ai_difficulty;
+    rgb_matrix_set_scan(refresh_hz < UINT16_MAX ? refresh_hz : UINT16_MAX, brightness);
+#if SCAN_INTERRUPT
+    rgb_matrix_start_scan();
+#endif
+
+    // The display thread keeps scanning every millisecond however long the simulation thread sleeps for
+    uint64_t end_ns = run_ms * 1000000ull;
+    uint64_t next_dump_ns = TRACE_DUMP_MS * 1000000ull;
+#if !EXECUTIVE_ENABLED
+    uint64_t next_step_ns = 0;
+#endif
+#if MIRROR_ENABLED
+    uint64_t next_mirror_ns = MIRROR_PERIOD_MS * 1000000ull;
+#endif
+    uint32_t ms = 0;
+    for (; run_ticks ? game.simulationTicks < run_ticks : host_time_ns() < end_ns; ms++) {
+
+        uint64_t iteration_ns = host_time_ns();
+#if EXECUTIVE_ENABLED
+        // One paced frame, with the simulation steps and the scene drawing in the idle part of its rows
+        clock::time_point begin = clock::now();
+        rgb_matrix_frame();
+        frame_virtual_ns += host_time_ns() - iteration_ns;
+        frame_time += clock::now() - begin;
+        frames++;
+#else
+
+        if (host_time_ns() >= next_step_ns) {
+            clock::time_point begin = clock::now();
+            simulation_step(game);
+            publishSnapshot(game);
+            simulation_time += clock::now() - begin;
+            steps++;
+
+            // Same cadence as the sleep in simulate(), unless jitter is asked for. The sleep never goes past the
+            // requested tick count, so every jitter setting stops on the same tick
+            uint32_t sleep_ms = eventDrivenSimulation ? simulation_sleep_ms(game) : 1 + jitter() % jitter_ms;
+            if (run_ticks && game.simulationTicks + sleep_ms > run_ticks) sleep_ms = run_ticks - game.simulationTicks;
+            next_step_ns = host_time_ns() + (sleep_ms ? sleep_ms : 1) * 1000000ull;
+        }
+
+        if (ms % frame_every == 0) {
+            clock::time_point begin = clock::now();
+            uint64_t virtual_begin = host_time_ns();
+#if SCAN_INTERRUPT
+            rgb_matrix_render();
+#else
+            rgb_matrix_frame();
+#endif
+            frame_virtual_ns += host_time_ns() - virtual_begin;
+            frame_time += clock::now() - begin;
+            frames++;
+        }
+
+        // A paced scan frame already took its time. On the device the scan thread loops straight into the next one
+        if (host_time_ns() == iteration_ns) thread_sleep_for(1);
+#endif
+
+        if (trace_file && host_time_ns() >= next_dump_ns) {
+            trace_dump(write_trace);
+            next_dump_ns += TRACE_DUMP_MS * 1000000ull;
+        }
+#if MIRROR_ENABLED
+        if (mirror_file && host_time_ns() >= next_mirror_ns) {
+            mirror_send(write_mirror);
+            next_mirror_ns += MIRROR_PERIOD_MS * 1000000ull;
+        }
+#endif
+    }
+    if (trace_file) {
+        // Whatever was recorded since the last periodic dump
+        if (host_time_ns() + TRACE_DUMP_MS * 1000000ull > next_dump_ns) trace_dump(write_trace);
+        fclose(trace_file);
+    }
+    host_gpio_set_sink(nullptr, nullptr);
+    if (mirror_file) fclose(mirror_file);
+    if (capture.raw) fclose(capture.raw);
+#if RECORD_ENABLED
+    if (record_file) {
+        record_dump(write_record);
+        fclose(record_file);
+    }
+#endif
+
+    double frame_ns = std::chrono::duration<double, std::nano>(frame_time).count();
+
+    printf("virtual time:       %llu ms\n", (unsigned long long)(host_time_ns() / 1000000));
+#if EXECUTIVE_ENABLED
+    // The steps ran inside the frames, so their time is in the frame time
+    steps = executiveStats.steps;
+    printf("simulation steps:   %u (in the scan's idle windows)\n", steps);
+    printf("executive:          %u idle windows, %u steps, %u render windows, %u overruns, longest work %u us\n",
+           executiveStats.windows, executiveStats.steps, executiveStats.renderWindows, executiveStats.overruns,
+           executiveStats.longestWorkUs);
+#else
+    double simulation_ns = std::chrono::duration<double, std::nano>(simulation_time).count();
+    printf("simulation steps:   %u (%.1f ns/step)\n", steps, steps ? simulation_ns / steps : 0.0);
+#endif
+    printf("simulation ticks:   %u\n", game.simulationTicks);
+    printf("wakeups:            %.1f per virtual second (%s)\n", steps * 1e9 / host_time_ns(),
+           eventDrivenSimulation ? "event driven" : "every step");
+    printf("matrix frames:      %u (%.1f ns per %s)\n", matrixFrames, frames ? frame_ns / frames : 0.0,
+           SCAN_INTERRUPT ? "render call" : "frame");
+    printf("scan schedule:      %u Hz, brightness %u, %u of %u us lit per row\n", scanSchedule.refreshHz,
+           scanSchedule.brightness, (unsigned)scanSchedule.litUs, (unsigned)scanSchedule.rowUs);
+    printf("scan achieved:      %.1f Hz, rows lit %.1f%% of the time\n", scanStats.frames * 1e9 / host_time_ns(),
+           100.0 * scanStats.litUs * 1000 / host_time_ns());
+    printf("rows rebuilt:       %u in %u scenes (%.1f of %u per scene, %.2f per frame)\n", renderStats.rows,
+           renderStats.scenes, renderStats.scenes ? (double)renderStats.rows / renderStats.scenes : 0.0, SCAN_ROWS,
+           scanStats.frames ? (double)renderStats.rows / scanStats.frames : 0.0);
+    if (decoder.rows) {
+        printf("row period:         %.1f/%.1f/%.1f us min/mean/max\n", decoder.min_period_ns / 1000.0,
+               decoder.total_period_ns / 1000.0 / decoder.rows, decoder.max_period_ns / 1000.0);
+        printf("row lit time:       %.1f/%.1f/%.1f us min/mean/max (%.1f%% duty)\n", decoder.min_lit_ns / 1000.0,
+               decoder.total_lit_ns / 1000.0 / decoder.rows, decoder.max_lit_ns / 1000.0,
+               100.0 * decoder.total_lit_ns / decoder.total_period_ns);
+    }
+    if (decoder.frames) {
+        printf("panel frames:       %llu decoded, %.1f Hz (period %.1f/%.1f us min/max)\n",
+               (unsigned long long)decoder.frames, scan_decoder_refresh_hz(decoder), decoder.min_frame_ns / 1000.0,
+               decoder.max_frame_ns / 1000.0);
+        printf("row duty per frame: %.1f%%/%.1f%% min/max\n", 100.0 * decoder.min_row_lit_ns * decoder.frames / decoder.total_frame_ns,
+               100.0 * decoder.max_row_lit_ns * decoder.frames / decoder.total_frame_ns);
+        printf("row changes:        %llu, %llu while lit, blanked %.2f/%.2f us min/mean\n",
+               (unsigned long long)decoder.row_changes, (unsigned long long)decoder.lit_row_changes,
+               decoder.row_changes ? decoder.min_blank_ns / 1000.0 : 0.0,
+               decoder.row_changes ? decoder.total_blank_ns / 1000.0 / decoder.row_changes : 0.0);
+        printf("ghosting:           %llu windows, %.1f us lit on the wrong row\n",
+               (unsigned long long)decoder.ghost_windows, decoder.ghost_ns / 1000.0);
+        printf("frame hash:         %016llx\n", (unsigned long long)capture.hash);
+    }
+    if (frame_virtual_ns) {
+        double period_us = frame_virtual_ns / 1000.0 / frames;
+        printf("timed scan:         %.1f us/frame (%.1f Hz ceiling)\n", period_us, 1e6 / period_us);
+    }
+#if MIRROR_ENABLED
+    if (mirrorStats.packets) {
+        printf("mirror:             %u packets, %u keyframes, %.1f bytes and %.1f rows per packet, largest %u, %u held back\n",
+               mirrorStats.packets, mirrorStats.keyframes, (double)mirrorStats.bytes / mirrorStats.packets,
+               (double)mirrorStats.rows / mirrorStats.packets, mirrorStats.largestPacket, mirrorStats.throttled);
+        printf("mirror frame hash:  %08x\n", mirror_frame_hash());
+    }
+#endif
+    printf("gpio writes:        %llu (%.1f per frame)\n", (unsigned long long)host_gpio_total_writes(),
+           matrixFrames ? (double)host_gpio_total_writes() / matrixFrames : 0.0);
+    printf("  PDOR/PSOR/PCOR:   %llu/%llu/%llu\n", (unsigned long long)host_gpio_write_count(HOST_PDOR),
+           (unsigned long long)host_gpio_write_count(HOST_PSOR), (unsigned long long)host_gpio_write_count(HOST_PCOR));
+    printf("ball:               (%u, %u) color %u\n", game.ball.x_int, game.ball.y_int, game.ball.color);
+#if MULTIBALL_ENABLED
+    // Code takes no virtual time, so the ramp always reaches MULTIBALL_MAX here. multiball_bench times it for real
+    printf("extra balls:        %u (ramp %s)\n", balls.count, multiballRamping ? "still going" : "done");
+#endif
+    printf("ai predictions:     %u\n", game.ai.predictions);
+    printf("display score:      0x%04x\n", game.display_score);
+    printf("state hash:         %016llx\n", (unsigned long long)state_hash());
+
+    return 0;
+}
@@ -0,0 +1,95 @@
+/* Copyright 2023 Collin Bollinger
+ *
+ * host/pong_replay.cpp
+ *
+ * Replays an input recording (input_record.h) as fast as the host can simulate it. The file can be a raw capture of
+ * the device's serial output: the last complete dump in it is used. Every checkpoint in the recording is compared
+ * with the replayed game, so a replay doubles as a regression test of the simulation (the exit status is 1 if any
+ * checkpoint differs) and, with --repeat, as a steady workload for timing or profiling simulation_tick().
+ *
+ * Usage: pong_replay FILE [--repeat N] [--header OUT]
+ *   --repeat N    Replay N times and report the average time per tick
+ *   --header OUT  Also write the dump as a C array to OUT, to be compiled into a device build with REPLAY_ENABLED as
+ *                 replay_dump.h
+ */
+
+#include "input_record.h"
+
+#include <chrono>
+#include <vector>
+
+// Only the game's tick count matters for the replay, not its clock
+static uint32_t noClock(void *context){ return 0; }
+
+int main(int argc, char **argv){
+
+    if (argc < 2) { fprintf(stderr, "usage: pong_replay FILE [--repeat N] [--header OUT]\n"); return 2; }
+
+    uint32_t repeat = 1;
+    const char *header_path = nullptr;
+    for (int i = 2; i + 1 < argc; i += 2) {
+        if (!strcmp(argv[i], "--repeat")) repeat = strtoul(argv[i + 1], nullptr, 0);
+        else if (!strcmp(argv[i], "--header")) header_path = argv[i + 1];
+        else { fprintf(stderr, "bad argument %s %s\n", argv[i], argv[i + 1]); return 2; }
+    }
+    if (repeat == 0) repeat = 1;
+
+    FILE *file = fopen(argv[1], "rb");
+    if (!file) { perror(argv[1]); return 2; }
+    std::vector<uint8_t> data;
+    uint8_t buffer[4096];
+    for (size_t got; (got = fread(buffer, 1, sizeof(buffer), file)) > 0;) data.insert(data.end(), buffer, buffer + got);
+    fclose(file);
+
+    // Last complete dump in the file
+    size_t start = SIZE_MAX;
+    for (size_t i = 0; i + sizeof(RecordHeader) <= data.size(); i++) {
+        RecordHeader header;
+        memcpy(&header, &data[i], sizeof(header));
+        if (header.magic == RECORD_MAGIC && header.length <= data.size() - i - sizeof(header)) start = i;
+    }
+    if (start == SIZE_MAX) { fprintf(stderr, "%s: no complete recording\n", argv[1]); return 2; }
+    const uint8_t *dump = &data[start];
+    uint32_t size = data.size() - start;
+
+    GameState game;
+    Replay replay;
+    GameIO clock = { nullptr, nullptr, noClock, nullptr };
+    using steady = std::chrono::steady_clock;
+    steady::duration replay_time(0);
+
+    for (uint32_t run = 0; run < repeat; run++) {
+        if (!replay_start(replay, game, dump, size, clock)) {
+            fprintf(stderr, "%s: recorded with different physics, panel or format\n", argv[1]);
+            return 2;
+        }
+        steady::time_point begin = steady::now();
+        while (!replay_done(replay)) simulation_tick(game);
+        replay_time += steady::now() - begin;
+    }
+
+    const RecordHeader &header = replay.header;
+    double tick_ns = std::chrono::duration<double, std::nano>(replay_time).count() / repeat / (header.ticks ? header.ticks : 1);
+
+    printf("recording:          %u ticks, %u bytes of records (%.2f bytes per second of play)\n", header.ticks,
+           header.length, header.ticks ? header.length * (1e6 / SIM_STEP_US) / header.ticks : 0.0);
+    printf("seed:               %u\n", header.seed);
+    printf("replay:             %.1f ns/tick, %.0fx real time\n", tick_ns, SIM_STEP_US * 1000.0 / tick_ns);
+    printf("score:              %u - %u\n", game.score_left, game.score_right);
+    printf("checkpoints:        %u passed, %u differ", replay.checkpoints - replay.mismatches, replay.mismatches);
+    if (replay.mismatches) printf(" (first at tick %u)", replay.firstMismatch);
+    printf("%s\n", replay.corrupt ? ", records cut short" : "");
+
+    if (header_path) {
+        FILE *out = fopen(header_path, "w");
+        if (!out) { perror(header_path); return 2; }
+        fprintf(out, "// Input recording for REPLAY_ENABLED, written by pong_replay from %s\n", argv[1]);
+        fprintf(out, "const uint8_t replayDump[] = {");
+        for (uint32_t i = 0; i < sizeof(RecordHeader) + header.length; i++)
+            fprintf(out, "%s0x%02x,", i % 16 ? " " : "\n    ", dump[i]);
+        fprintf(out, "\n};\n");
+        fclose(out);
+    }
+
+    return replay.mismatches || replay.corrupt ? 1 : 0;
+}
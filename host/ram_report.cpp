@@ -0,0 +1,20 @@
+/* Copyright 2023 Collin Bollinger
+ *
+ * host/ram_report.cpp
+ *
+ * Prints the RAM the game's static blocks take in the variant it is built for, the table memory_layout_report()
+ * prints on the device at startup, so that the cost of a build flag can be seen without a device build. The device
+ * build refuses to compile a configuration that goes over RAM_BUDGET, the exit status is 1 for those here. The budget
+ * rests on the unmeasured RAM_MBED_OVERHEAD, so a variant under it isn't proven to fit (memory_layout.h).
+ *
+ * Usage: ram_report NAME
+ */
+
+#include "memory_layout.h"
+
+int main(int argc, char **argv){
+    printf("%s:", argc > 1 ? argv[1] : "ram_report");
+    bool fits = memory_layout_report();
+    printf("%s\n\n", fits ? "" : "\nRAM: over the budget, the device build doesn't compile");
+    return fits ? 0 : 1;
+}
@@ -0,0 +1,266 @@
+/* Copyright 2023 Collin Bollinger
+ *
+ * host/scan_bench.cpp
+ *
+ * Benchmark of the matrix scan kernel. Runs each implementation of the per-row scan against the recording GPIOC of
+ * the host build for a set of canned scenes, and reports time per frame, GPIO register writes per frame and how much
+ * the time per row varies across the rows of a frame. Before timing, every kernel's output is decoded from the GPIO
+ * writes and compared with the kernel in rgb_matrix.cpp, so a faster kernel that draws something else shows up.
+ *
+ * Times are host wall clock and only compare kernels with each other. Write counts carry over to the device as they
+ * are.
+ *
+ * Build with the PANEL_* flags of panel.h to bench another panel geometry.
+ *
+ * Usage: scan_bench [--frames N]
+ */
+
+#include "pong.h"
+
+#include <chrono>
+#include <cmath>
+
+using bench_clock = std::chrono::steady_clock;
+
+struct BenchScene {
+    const char *name;
+    GameSnapshot snapshot;
+};
+
+// leftPaddleRow, rightPaddleRow, displayScore, ballColor, ball_x, ball_y, showText, inputUs. Positions scale with the
+// panel geometry and are the same as on a 64x32 panel. No slider moved the paddles, so inputUs is 0
+static const BenchScene scenes[] = {
+    { "idle title", { (HEIGHT_PX - PADDLE_HEIGHT) / 2, (HEIGHT_PX - PADDLE_HEIGHT) / 2, 0, COLOR_WHITE, WIDTH_PX / 2, HEIGHT_PX / 2, true, 0 } },
+    { "mid rally", { HEIGHT_PX * 5 / 32, HEIGHT_PX - PADDLE_HEIGHT - 4, 0, COLOR_WHITE, WIDTH_PX * 5 / 8, HEIGHT_PX * 11 / 32, false, 0 } },
+    { "score flash", { HEIGHT_PX * 9 / 32, HEIGHT_PX - PADDLE_HEIGHT - 2, (5 << 8) | 7, COLOR_RED, 0, HEIGHT_PX * 3 / 8, false, 0 } },
+};
+
+/* ---- Kernels ----
+ * prepare() runs once per scene change, scan_row() once per row of every frame */
+
+struct Kernel {
+    const char *name;
+    void (*prepare)(const GameSnapshot &scene);
+    void (*scan_row)(uint8_t row_counter);
+};
+
+// The original kernel: every pixel of the row is tested against every element, and set and cleared with PSOR/PCOR,
+// up to four writes per column. It was written for one 64x32 panel and is left out for other geometries
+#if PANEL_WIDTH == 64 & PANEL_HEIGHT == 32 & PANEL_CHAIN == 1
+#define LEGACY_KERNEL 1
+static GameSnapshot legacyScene;
+static const uint16_t legacyTextMatrix[5] = { 0x8EAF, 0x8AA9, 0xEEEB, 0xA008, 0xE00F };
+static const uint8_t legacyTextOrigin[2] = { WIDTH_PX/2 - 8 - 1, HEIGHT_PX/2 - 3 };
+
+static void legacy_prepare(const GameSnapshot &scene){ legacyScene = scene; }
+
+static void legacy_scan_row(uint8_t row_counter){
+
+    uint8_t row_1 = row_counter;
+    uint8_t row_2 = row_counter + 16;
+    uint8_t row_out = HEIGHT_PX/2 - 1 - row_counter;
+
+    uint8_t leftPaddleRow = legacyScene.leftPaddleRow;
+    uint8_t rightPaddleRow = legacyScene.rightPaddleRow;
+    uint16_t barHeights = legacyScene.displayScore;
+    uint8_t ballColor = legacyScene.ballColor;
+    uint8_t ball_x = legacyScene.ball_x;
+    uint8_t ball_y = legacyScene.ball_y;
+    bool showText = legacyScene.showText;
+
+    for(int col = 0; col < WIDTH_PX; col++){
+
+        if(col == 0){
+            if((row_1 >= leftPaddleRow) & (row_1 <= leftPaddleRow + PADDLE_HEIGHT - 1)){ GPIOC->PSOR = (COLOR_GREEN << 8); }
+            if((row_2 >= leftPaddleRow) & (row_2 <= leftPaddleRow + PADDLE_HEIGHT - 1)){ GPIOC->PSOR = (COLOR_GREEN << 11); }
+        } else if(col == WIDTH_PX - 1){
+            if((row_1 >= rightPaddleRow) & (row_1 <= rightPaddleRow + PADDLE_HEIGHT - 1)){ GPIOC->PSOR = (COLOR_GREEN << 8); }
+            if((row_2 >= rightPaddleRow) & (row_2 <= rightPaddleRow + PADDLE_HEIGHT - 1)){ GPIOC->PSOR = (COLOR_GREEN << 11); }
+        } else if(col == WIDTH_PX / 2 + 11 | col == WIDTH_PX / 2 + 12){
+            if(row_1 < (barHeights & UINT8_MAX)){ GPIOC->PSOR = (SCORE_COLOR << 8); }
+            if(row_2 < (barHeights & UINT8_MAX)){ GPIOC->PSOR = (SCORE_COLOR << 11); }
+        } else if(col == WIDTH_PX / 2 - 12 | col == WIDTH_PX / 2 - 13){
+            if(row_1 < (barHeights >> 8)){ GPIOC->PSOR = (SCORE_COLOR << 8); }
+            if(row_2 < (barHeights >> 8)){ GPIOC->PSOR = (SCORE_COLOR << 11); }
+        }
+
+        if(col == ball_x) {
+            if(row_1 == ball_y) { GPIOC->PSOR = (ballColor << 8); }
+            if(row_2 == ball_y) { GPIOC->PSOR = (ballColor << 11); }
+        }
+
+        if(col >= legacyTextOrigin[0] & col <= legacyTextOrigin[0] + 15 & showText) {
+            if (row_1 >= legacyTextOrigin[1] & row_1 <= legacyTextOrigin[1] + 4) { if(legacyTextMatrix[row_1-13] & (1 << (38 - col))) { GPIOC->PSOR = (ballColor << 8); } }
+            if (row_2 >= legacyTextOrigin[1] & row_2 <= legacyTextOrigin[1] + 4) { if(legacyTextMatrix[row_2-13] & (1 << (38 - col))) { GPIOC->PSOR = (ballColor << 11); } }
+        }
+
+        GPIOC->PSOR = 4; // Set CLK high
+        GPIOC->PCOR = (7 << 11) | (7 << 8) | 4; // Clear CLK, RGB1, RGB2
+    }
+
+    GPIOC->PSOR = 2; // OE LOW
+    GPIOC->PDOR = (row_out << 3) | 1; // Set row select and set LATCH
+    GPIOC->PCOR = 1; // Clear latch
+}
+#endif
+
+// The current kernel: the scene is rendered into a packed frame buffer and each row is streamed with two PDOR writes
+// per column
+static port_word_t packedRows[SCAN_ROWS][WIDTH_PX];
+
+static void packed_prepare(const GameSnapshot &scene){ renderScene(scene, packedRows); }
+
+static void packed_scan_row(uint8_t row_counter){ rgb_matrix_scan_row(packedRows[row_counter], row_counter); }
+
+// Precomputed columns: the row select lines that stay on the port while a row is shifted in are folded into the
+// buffered words when the scene is rendered, so the inner loop only loads, stores and sets CLK
+static uint32_t precomputedRows[SCAN_ROWS][WIDTH_PX];
+
+static void precomputed_prepare(const GameSnapshot &scene){
+    renderScene(scene, packedRows);
+    for(uint8_t row = 0; row < SCAN_ROWS; row++){
+        // Row select of the previous row pair. The last row of a frame latches row select 0
+        uint32_t latched = row == 0 ? 0 : static_cast<uint32_t>(SCAN_ROWS - row) << PORT_ROW_SHIFT;
+        for(uint8_t col = 0; col < WIDTH_PX; col++){ precomputedRows[row][col] = latched | packedRows[row][col]; }
+    }
+}
+
+static void precomputed_scan_row(uint8_t row_counter){
+
+    const uint32_t *columns = precomputedRows[row_counter];
+    for(int col = 0; col < WIDTH_PX; col++){
+        uint32_t word = columns[col];
+        GPIOC->PDOR = word;
+        GPIOC->PDOR = word | PORT_CLK;
+    }
+
+    uint32_t rowWord = static_cast<uint32_t>(SCAN_ROWS - 1 - row_counter) << PORT_ROW_SHIFT;
+    GPIOC->PSOR = PORT_OE; // OE LOW
+    GPIOC->PDOR = rowWord | PORT_LAT; // Set row select and set LATCH
+    GPIOC->PCOR = PORT_LAT; // Clear latch
+}
+
+// The row interrupt: rgb_matrix_scan_tick() shifts the next row of the front buffer in with the panel blanked, and
+// lights it with the write that clears LAT, one write less per row than packed
+static void interrupt_prepare(const GameSnapshot &scene){ renderScene(scene, frameBuffer[frontBuffer]); }
+
+static void interrupt_scan_row(uint8_t row_counter){ rgb_matrix_scan_tick(); }
+
+static const Kernel kernels[] = {
+#ifdef LEGACY_KERNEL
+    { "legacy", legacy_prepare, legacy_scan_row },
+#endif
+    { "packed", packed_prepare, packed_scan_row },
+    { "precomputed", precomputed_prepare, precomputed_scan_row },
+    { "interrupt", interrupt_prepare, interrupt_scan_row },
+};
+
+#ifdef LEGACY_KERNEL
+static const Kernel &packedKernel = kernels[1];
+#else
+static const Kernel &packedKernel = kernels[0];
+#endif
+
+/* ---- Output check ----
+ * Decodes the panel contents from the GPIO writes: lane bits are shifted in on every CLK rising edge and the shift
+ * register is stored for the selected row on every LAT rising edge */
+
+struct PanelDecoder {
+    uint32_t previous = 0;
+    uint8_t shift[WIDTH_PX] = {};
+    uint8_t rows[SCAN_ROWS][WIDTH_PX] = {};
+};
+
+static void decode_write(const HostGpioWrite &write, void *context){
+    PanelDecoder &decoder = *static_cast<PanelDecoder*>(context);
+    uint32_t port = write.pdor;
+    if(!(decoder.previous & PORT_CLK) & !!(port & PORT_CLK)){
+        memmove(decoder.shift, decoder.shift + 1, WIDTH_PX - 1);
+        decoder.shift[WIDTH_PX - 1] = (port & PORT_RGB_MASK) >> PORT_RGB1_SHIFT;
+    }
+    if(!(decoder.previous & PORT_LAT) & !!(port & PORT_LAT)){
+        memcpy(decoder.rows[(port >> PORT_ROW_SHIFT) & (SCAN_ROWS - 1)], decoder.shift, WIDTH_PX);
+    }
+    decoder.previous = port;
+}
+
+static void scan_frame(const Kernel &kernel){
+    for(uint8_t row = 0; row < SCAN_ROWS; row++) kernel.scan_row(row);
+}
+
+static void decode_panel(const Kernel &kernel, const GameSnapshot &scene, PanelDecoder &decoder){
+    host_reset();
+    host_gpio_set_sink(decode_write, &decoder);
+    kernel.prepare(scene);
+    scan_frame(kernel);
+    host_gpio_set_sink(nullptr, nullptr);
+}
+
+int main(int argc, char **argv){
+
+    uint32_t frames = 2000;
+    for(int i = 1; i + 1 < argc; i += 2){
+        if(!strcmp(argv[i], "--frames")) frames = strtoul(argv[i + 1], nullptr, 0);
+    }
+    if(frames == 0) frames = 1;
+
+    rgb_matrix_init(); // Draws the title layer
+
+    printf("%-12s %-12s %6s %10s %10s %12s %10s %8s\n", "scene", "kernel", "output", "ns/frame", "writes", "writes/row",
+           "row ns", "row cv");
+
+    for(const BenchScene &scene : scenes){
+
+        PanelDecoder reference;
+        decode_panel(packedKernel, scene.snapshot, reference);
+
+        for(const Kernel &kernel : kernels){
+
+            PanelDecoder decoded;
+            decode_panel(kernel, scene.snapshot, decoded);
+            bool same = memcmp(decoded.rows, reference.rows, sizeof(reference.rows)) == 0;
+
+            // Write counts of one frame, row by row
+            host_reset();
+            kernel.prepare(scene.snapshot);
+            uint64_t minRowWrites = UINT64_MAX, maxRowWrites = 0;
+            for(uint8_t row = 0; row < SCAN_ROWS; row++){
+                uint64_t before = host_gpio_total_writes();
+                kernel.scan_row(row);
+                uint64_t writes = host_gpio_total_writes() - before;
+                minRowWrites = writes < minRowWrites ? writes : minRowWrites;
+                maxRowWrites = writes > maxRowWrites ? writes : maxRowWrites;
+            }
+            uint64_t frameWrites = host_gpio_total_writes();
+
+            // Time per row, summed over every frame
+            bench_clock::duration rowTime[SCAN_ROWS] = {};
+            bench_clock::time_point begin = bench_clock::now();
+            for(uint32_t frame = 0; frame < frames; frame++){
+                for(uint8_t row = 0; row < SCAN_ROWS; row++){
+                    bench_clock::time_point rowBegin = bench_clock::now();
+                    kernel.scan_row(row);
+                    rowTime[row] += bench_clock::now() - rowBegin;
+                }
+            }
+            double frameNs = std::chrono::duration<double, std::nano>(bench_clock::now() - begin).count() / frames;
+
+            // Mean row time and its coefficient of variation across the rows of a frame
+            double mean = 0, variance = 0;
+            for(uint8_t row = 0; row < SCAN_ROWS; row++) mean += std::chrono::duration<double, std::nano>(rowTime[row]).count() / frames;
+            mean /= SCAN_ROWS;
+            for(uint8_t row = 0; row < SCAN_ROWS; row++){
+                double d = std::chrono::duration<double, std::nano>(rowTime[row]).count() / frames - mean;
+                variance += d * d;
+            }
+            variance /= SCAN_ROWS;
+
+            char rowWrites[24];
+            snprintf(rowWrites, sizeof(rowWrites), "%llu-%llu", (unsigned long long)minRowWrites, (unsigned long long)maxRowWrites);
+            printf("%-12s %-12s %6s %10.0f %10llu %12s %10.1f %7.1f%%\n", scene.name, kernel.name, same ? "same" : "DIFF",
+                   frameNs, (unsigned long long)frameWrites, rowWrites, mean, mean > 0 ? 100 * sqrt(variance) / mean : 0.0);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,149 @@
+/* Copyright 2023 Collin Bollinger
+ *
+ * host/scan_decoder.cpp
+ */
+
+#include "scan_decoder.h"
+
+#include <algorithm>
+
+// Row select on the port
+static inline uint8_t selectedRow(uint32_t port){ return (port & PORT_ROW_MASK) >> PORT_ROW_SHIFT; }
+
+// Adds the time since the last change to whatever the panel showed in it
+static void light(ScanDecoder &decoder, uint64_t now_ns){
+
+    uint64_t elapsed = now_ns - decoder.since_ns;
+    decoder.since_ns = now_ns;
+    if (elapsed == 0) return;
+
+    bool lit = !(decoder.previous & PORT_OE);
+    if (lit) decoder.latch_lit_ns += elapsed;
+
+    bool ghost = false;
+    if (lit && decoder.latched) {
+        uint8_t row = selectedRow(decoder.previous);
+        decoder.row_lit[row] += elapsed;
+        for (uint8_t x = 0; x < WIDTH_PX; x++)
+            for (uint8_t bits = decoder.latch[x], b = 0; bits; bits >>= 1, b++)
+                if (bits & 1) decoder.lit[row][x][b] += elapsed;
+        ghost = row != decoder.latch_row;
+    }
+    if (ghost) {
+        decoder.ghost_ns += elapsed;
+        if (!decoder.ghosting) decoder.ghost_windows++;
+    }
+    decoder.ghosting = ghost;
+}
+
+// Hands the frame that ended at now_ns to the sink and starts the next one
+static void endFrame(ScanDecoder &decoder, uint64_t now_ns){
+
+    uint64_t period = now_ns - decoder.frame_start_ns;
+    decoder.frames++;
+    decoder.total_frame_ns += period;
+    decoder.min_frame_ns = std::min(decoder.min_frame_ns, period);
+    decoder.max_frame_ns = std::max(decoder.max_frame_ns, period);
+
+    // Colour bits are green, blue, red from bit 0 up
+    static const uint8_t channel[3] = { 1, 2, 0 };
+    ScanFrame &frame = decoder.frame;
+    frame.start_ns = decoder.frame_start_ns;
+    frame.end_ns = now_ns;
+    for (uint8_t row = 0; row < SCAN_ROWS; row++) {
+        uint64_t row_lit = decoder.row_lit[row];
+        decoder.min_row_lit_ns = std::min(decoder.min_row_lit_ns, row_lit);
+        decoder.max_row_lit_ns = std::max(decoder.max_row_lit_ns, row_lit);
+
+        // The scan engines flip the frame buffer rows onto the row select
+        uint8_t y = SCAN_ROWS - 1 - row;
+        for (uint8_t x = 0; x < WIDTH_PX; x++) {
+            for (uint8_t b = 0; b < 6; b++) {
+                uint8_t level = row_lit ? (decoder.lit[row][x][b] * 255 + row_lit / 2) / row_lit : 0;
+                frame.rgb[b < 3 ? y : y + SCAN_ROWS][x][channel[b % 3]] = level;
+            }
+        }
+    }
+    if (decoder.sink) decoder.sink(frame, decoder.sink_context);
+
+    memset(decoder.lit, 0, sizeof(decoder.lit));
+    memset(decoder.row_lit, 0, sizeof(decoder.row_lit));
+    decoder.frame_start_ns = now_ns;
+}
+
+void scan_decoder_write(const HostGpioWrite &write, void *context){
+
+    ScanDecoder &decoder = *static_cast<ScanDecoder*>(context);
+    uint32_t port = write.pdor;
+    uint32_t changed = decoder.previous ^ port;
+    uint32_t rising = changed & port;
+    uint64_t now = write.time_ns;
+
+    // Shifting only changes what the panel shows once it is latched
+    if (rising & PORT_CLK) {
+        memmove(decoder.shift, decoder.shift + 1, WIDTH_PX - 1);
+        decoder.shift[WIDTH_PX - 1] = (port >> PORT_RGB1_SHIFT & 7) | (port >> PORT_RGB2_SHIFT & 7) << 3;
+    }
+    if (!(changed & (PORT_OE | PORT_ROW_MASK)) && !(rising & PORT_LAT)) { decoder.previous = port; return; }
+
+    light(decoder, now);
+
+    if (changed & PORT_ROW_MASK) {
+        if (!(decoder.previous & PORT_OE) && !(port & PORT_OE)) {
+            decoder.row_changes++;
+            decoder.lit_row_changes++;
+            decoder.min_blank_ns = 0;
+        } else {
+            decoder.row_changed_blank = true;
+        }
+    }
+    if (changed & PORT_OE) {
+        if (port & PORT_OE) {
+            decoder.blank_since_ns = now;
+        } else if (decoder.row_changed_blank) {
+            uint64_t blank = now - decoder.blank_since_ns;
+            decoder.row_changes++;
+            decoder.total_blank_ns += blank;
+            decoder.min_blank_ns = std::min(decoder.min_blank_ns, blank);
+            decoder.row_changed_blank = false;
+        }
+    }
+
+    if (rising & PORT_LAT) {
+        uint8_t row = selectedRow(port);
+
+        // The first latch only starts the first row and the first frame
+        if (decoder.latched) {
+            uint64_t period = now - decoder.latch_ns;
+            decoder.rows++;
+            decoder.total_period_ns += period;
+            decoder.total_lit_ns += decoder.latch_lit_ns;
+            decoder.min_period_ns = std::min(decoder.min_period_ns, period);
+            decoder.max_period_ns = std::max(decoder.max_period_ns, period);
+            decoder.min_lit_ns = std::min(decoder.min_lit_ns, decoder.latch_lit_ns);
+            decoder.max_lit_ns = std::max(decoder.max_lit_ns, decoder.latch_lit_ns);
+        } else {
+            decoder.first_row = row;
+            decoder.frame_start_ns = now;
+        }
+        decoder.latch_ns = now;
+        decoder.latch_lit_ns = 0;
+
+        // BCM latches every row once per plane, so a frame only ends when the first row comes round again
+        if (decoder.latched && row == decoder.first_row && decoder.latch_row != decoder.first_row) endFrame(decoder, now);
+
+        memcpy(decoder.latch, decoder.shift, WIDTH_PX);
+        decoder.latch_row = row;
+        decoder.latched = true;
+    }
+
+    decoder.previous = port;
+}
+
+bool scan_frame_write_ppm(const ScanFrame &frame, const char *path){
+    FILE *file = fopen(path, "wb");
+    if (!file) return false;
+    fprintf(file, "P6\n%d %d\n255\n", WIDTH_PX, HEIGHT_PX);
+    bool written = fwrite(frame.rgb, sizeof(frame.rgb), 1, file) == 1;
+    return fclose(file) == 0 && written;
+}
@@ -0,0 +1,77 @@
+/* Copyright 2023 Collin Bollinger
+ *
+ * host/scan_decoder.h
+ *
+ * Model of the HUB75 panel on the other end of GPIOC, fed with every port write through host_gpio_set_sink(). It
+ * shifts the RGB1/RGB2 lanes in on each CLK rising edge, copies the shift register to the output latch on each LAT
+ * rising edge and, while OE is low, lights the latched pixels on the rows the A-E lines select. How long each pixel
+ * was lit gives back the frames the panel showed, whichever scan engine drove it, and the same timeline gives the
+ * refresh rate, the duty cycle of every row and the windows in which a row shows data meant for another one.
+ *
+ * A frame is everything between two latches of the row the scan starts with. Each pixel of a decoded frame is the
+ * share of its row's lit time it was on for, scaled to 255: a plain scan gives 0 or 255 and BCM gives its gamma
+ * levels, so frames from both engines compare equal for the same scene.
+ */
+
+#ifndef SCAN_DECODER_H
+#define SCAN_DECODER_H
+
+#include "pong.h"
+
+// One decoded frame, top row first, in the orientation the game draws it
+struct ScanFrame {
+    uint64_t start_ns, end_ns; // Virtual time of the latches that started and ended it
+    uint8_t rgb[HEIGHT_PX][WIDTH_PX][3];
+};
+
+struct ScanDecoder {
+    uint32_t previous = 0; // Port after the last write
+    uint64_t since_ns = 0; // When the lit rows and latch last changed
+    uint8_t shift[WIDTH_PX] = {}; // RGB1 in bits 0-2 and RGB2 in bits 3-5, in colour bit order
+    uint8_t latch[WIDTH_PX] = {};
+    uint8_t latch_row = 0; // Row select at the last latch, the row the latched data is meant for
+    bool latched = false;
+    bool ghosting = false;
+
+    // Frame being decoded
+    uint8_t first_row = 0; // Row the scan starts each frame with, from the first latch seen
+    uint64_t frame_start_ns = 0;
+    uint32_t lit[SCAN_ROWS][WIDTH_PX][6] = {}; // ns each lane bit was lit for
+    uint32_t row_lit[SCAN_ROWS] = {}; // ns each row was lit for
+
+    // Frame sink, called at the end of every complete frame
+    void (*sink)(const ScanFrame &frame, void *context) = nullptr;
+    void *sink_context = nullptr;
+    ScanFrame frame;
+
+    // Latch to latch timing, one period per latch after the first
+    uint64_t latch_ns = 0, latch_lit_ns = 0;
+    uint64_t rows = 0, total_period_ns = 0, total_lit_ns = 0;
+    uint64_t min_period_ns = UINT64_MAX, max_period_ns = 0, min_lit_ns = UINT64_MAX, max_lit_ns = 0;
+
+    // Frame timing
+    uint64_t frames = 0, total_frame_ns = 0;
+    uint64_t min_frame_ns = UINT64_MAX, max_frame_ns = 0;
+    uint64_t min_row_lit_ns = UINT64_MAX, max_row_lit_ns = 0; // Lit time of one row in one frame
+
+    // Ghosting: time the panel was lit with the row select on another row than the latched data is meant for
+    uint64_t ghost_ns = 0, ghost_windows = 0;
+
+    // Row changes: blanking is the time OE was high around a change of the row select
+    uint64_t row_changes = 0, lit_row_changes = 0, total_blank_ns = 0, min_blank_ns = UINT64_MAX;
+    uint64_t blank_since_ns = 0;
+    bool row_changed_blank = false; // The row select changed since OE last went high
+};
+
+/* Sink for host_gpio_set_sink(), context is the ScanDecoder */
+void scan_decoder_write(const HostGpioWrite &write, void *context);
+
+/* Refresh rate in Hz from the decoded frames, 0 before the first complete frame */
+inline double scan_decoder_refresh_hz(const ScanDecoder &decoder){
+    return decoder.frames ? decoder.frames * 1e9 / decoder.total_frame_ns : 0.0;
+}
+
+/* Writes frame as a binary PPM. Returns false if the file can't be written */
+bool scan_frame_write_ppm(const ScanFrame &frame, const char *path);
+
+#endif
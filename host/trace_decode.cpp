@@ -0,0 +1,113 @@
+/* Copyright 2023 Collin Bollinger
+ *
+ * host/trace_decode.cpp
+ *
+ * Decodes the binary trace dumps written by trace_dump() (see trace.h). The input can be a raw capture of the serial
+ * port: anything between dumps, like printf output, is skipped by looking for the dump magic. Prints the counters and
+ * the count, percentiles and maximum of every event for each dump. A percentile is interpolated inside the bucket it
+ * falls in (see trace_bucket()), which is exact for values below 8 and within a quarter of the value above. The
+ * event's minimum and maximum narrow the lowest and highest buckets down to what was recorded.
+ *
+ * Usage: trace_decode [--records] [FILE]
+ *   --records  Also print the ring of most recent events
+ *   FILE       Capture to decode (default stdin), e.g. from: cat /dev/ttyACM0 > capture.bin
+ */
+
+#include "trace.h"
+
+#include <algorithm>
+#include <vector>
+
+static const char *event_names[TRACE_EVENTS] = {
+    "frame period", "row dwell", "step time", "physics", "snapshot read", "wakeup latency", "scan tick", "multiball",
+    "input latency",
+};
+static const char *event_units[TRACE_EVENTS] = { "us", "cycles", "cycles", "cycles", "cycles", "us", "cycles", "cycles", "us" };
+static const char *counter_names[TRACE_COUNTERS] = {
+    "ticks", "dropped ticks", "wakeups", "frames", "stale snapshots", "dropped input", "balls", "sustained balls",
+};
+
+/* Value below which the given fraction of the samples fall. The samples in a bucket are taken to be spread evenly
+ * over the part of it between the event's minimum and maximum. total is the sum of the counts, which is less than the
+ * event count once the buckets were halved */
+static uint32_t percentile(const uint16_t *counts, uint64_t total, const TraceTotals &totals, double fraction){
+    double target = fraction * total;
+    uint64_t seen = 0;
+    for (uint8_t b = 0; b < TRACE_BUCKETS; b++) {
+        if (counts[b] == 0 || seen + counts[b] < target) { seen += counts[b]; continue; }
+        uint32_t low = std::max(trace_bucket_low(b), totals.min);
+        uint32_t top = b == TRACE_BUCKETS - 1 ? totals.max : std::min(trace_bucket_low(b + 1) - 1, totals.max);
+        uint32_t value = low + static_cast<uint32_t>((target - seen) / counts[b] * (top - low + 1.0));
+        return std::min(value, top);
+    }
+    return totals.max;
+}
+
+int main(int argc, char **argv){
+
+    bool show_records = false;
+    FILE *in = stdin;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--records")) show_records = true;
+        else if (!(in = fopen(argv[i], "rb"))) { perror(argv[i]); return 2; }
+    }
+
+    std::vector<uint8_t> data;
+    uint8_t chunk[4096];
+    size_t got;
+    while ((got = fread(chunk, 1, sizeof(chunk), in)) > 0) data.insert(data.end(), chunk, chunk + got);
+
+    int dumps = 0;
+    for (size_t at = 0; at + sizeof(TraceDumpHeader) <= data.size(); at++) {
+
+        TraceDumpHeader header;
+        memcpy(&header, &data[at], sizeof(header));
+        if (header.magic != TRACE_MAGIC) continue;
+        if (header.version != TRACE_VERSION | header.events != TRACE_EVENTS | header.buckets != TRACE_BUCKETS) {
+            fprintf(stderr, "dump at byte %zu has an unknown layout (version %u)\n", at, header.version);
+            continue;
+        }
+
+        size_t size = sizeof(header) + header.counters * 4 + header.events * (sizeof(TraceTotals) + header.buckets * 2) +
+                      header.records * sizeof(TraceRecord);
+        if (at + size > data.size()) { fprintf(stderr, "dump at byte %zu is cut off\n", at); break; }
+
+        const uint8_t *p = &data[at + sizeof(header)];
+        std::vector<uint32_t> counters(header.counters);
+        memcpy(counters.data(), p, header.counters * 4);
+        p += header.counters * 4;
+
+        printf("dump %d at %.3f s\n", ++dumps, header.time_us / 1e6);
+        for (uint8_t c = 0; c < header.counters; c++) printf("  %-16s %u\n", c < TRACE_COUNTERS ? counter_names[c] : "?", counters[c]);
+
+        printf("  %-16s %10s %10s %10s %10s %10s\n", "event", "count", "p50", "p90", "p99", "max");
+        for (uint8_t e = 0; e < header.events; e++) {
+            TraceTotals totals;
+            uint16_t counts[TRACE_BUCKETS];
+            memcpy(&totals, p, sizeof(totals));
+            memcpy(counts, p + sizeof(totals), sizeof(counts));
+            p += sizeof(totals) + sizeof(counts);
+
+            uint64_t total = 0;
+            for (uint8_t b = 0; b < TRACE_BUCKETS; b++) total += counts[b];
+            if (totals.count == 0) { printf("  %-16s %10u\n", event_names[e], 0); continue; }
+            printf("  %-16s %10u %10u %10u %10u %10u %s\n", event_names[e], totals.count,
+                   percentile(counts, total, totals, 0.5), percentile(counts, total, totals, 0.9),
+                   percentile(counts, total, totals, 0.99), totals.max, event_units[e]);
+        }
+
+        if (show_records) {
+            for (uint32_t r = 0; r < header.records; r++) {
+                TraceRecord record;
+                memcpy(&record, p + r * sizeof(record), sizeof(record));
+                uint8_t event = record.value_event >> 24;
+                printf("  %12u us  %-16s %u\n", record.time_us, event < TRACE_EVENTS ? event_names[event] : "?", record.value_event & 0xFFFFFF);
+            }
+        }
+
+        at += size - 1;
+    }
+
+    if (dumps == 0) { fprintf(stderr, "no trace dumps found\n"); return 1; }
+    return 0;
+}
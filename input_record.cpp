@@ -0,0 +1,271 @@
+/* Copyright 2023 Collin Bollinger
+ *
+ * input_record.cpp
+ */
+
+#include "input_record.h"
+#include "pong_ai.h"
+
+uint32_t record_state_hash(const GameState &game){
+
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    auto add = [&hash](const void *data, size_t size) {
+        for(size_t i = 0; i < size; i++){ hash ^= static_cast<const uint8_t*>(data)[i]; hash *= 16777619u; }
+    };
+    add(&game.ball.x_pos, sizeof(real_t));
+    add(&game.ball.y_pos, sizeof(real_t));
+    add(&game.ball.x_slope, sizeof(real_t));
+    add(&game.ball.y_slope, sizeof(real_t));
+    uint8_t state[] = { game.leftPaddle.y_idx, game.rightPaddle.y_idx, game.score_left, game.score_right,
+                        game.running, game.paused, game.practiceMode, game.pointResetting };
+    add(state, sizeof(state));
+    return hash;
+}
+
+// The bits of a real_t, to store rules in the header
+inline uint32_t realBits(real_t value){
+#if PONG_FIXED_POINT
+    return value.raw;
+#else
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+#endif
+}
+
+inline real_t realFromBits(uint32_t bits){
+#if PONG_FIXED_POINT
+    return Fix16::fromRaw(bits);
+#else
+    real_t value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+#endif
+}
+
+// Header fields that describe the game rather than the recording
+void describeGame(RecordHeader &header, const GameRules &rules, uint32_t seed){
+    header.magic = RECORD_MAGIC;
+    header.version = RECORD_VERSION;
+    header.fixedPoint = PONG_FIXED_POINT;
+    header.width = WIDTH_PX;
+    header.height = HEIGHT_PX;
+    header.aiDifficulty = rules.aiDifficulty;
+    header.reserved = 0;
+    header.beginVelocity = realBits(rules.beginVelocity);
+    header.bounceSpeedup = realBits(rules.bounceSpeedup);
+    header.seed = seed;
+}
+
+#if RECORD_ENABLED
+
+uint8_t recordBuffer[RECORD_BUFFER_SIZE];
+uint32_t recordLength = 0;
+RecordHeader recordHeader;
+bool recordFull = false;
+
+// Records of every tick before recordTicks are in the first recordCommitted bytes. recordTicks is written last and
+// read first, so a dump never claims a tick it doesn't have the records for
+std::atomic<uint32_t> recordCommitted(0);
+std::atomic<uint32_t> recordTicks(0);
+
+// The recorded game and where its input really comes from
+GameState *recordGame;
+GameIO recordSource;
+
+uint32_t recordTick = 0; // Tick of the last record
+uint32_t recordSeenTick = 0; // Tick of the last button check, not counting tick 0's
+uint8_t recordRow[INPUT_SLIDERS]; // Last recorded paddle row of each slider, UINT8_MAX before the first
+uint32_t latchTick[INPUT_SLIDERS]; // Tick the slider levels below were read in
+uint16_t latchLevel[INPUT_SLIDERS];
+
+// Appends a record with size bytes of payload, unless that would overflow the buffer
+void appendRecord(uint8_t type, const uint8_t *payload, uint8_t size){
+
+    if(recordFull) return;
+
+    uint8_t bytes[6 + 4];
+    uint8_t length = 0;
+    uint32_t gap = recordGame->simulationTicks - recordTick;
+    bytes[length++] = type << 6 | (gap < 63 ? gap : 63);
+    if(gap >= 63){
+        for(gap -= 63; gap >= 0x80; gap >>= 7) bytes[length++] = gap | 0x80;
+        bytes[length++] = gap;
+    }
+    memcpy(bytes + length, payload, size);
+    length += size;
+
+    if(recordLength + length > RECORD_BUFFER_SIZE){
+        recordFull = true;
+        return;
+    }
+    memcpy(recordBuffer + recordLength, bytes, length);
+    recordLength += length;
+    recordTick = recordGame->simulationTicks;
+}
+
+bool recordNextEvent(void *context, InputEvent &event){
+
+    // checkButtons() is the first thing every tick does, so the first call of a tick finishes the previous one
+    uint32_t tick = recordGame->simulationTicks;
+    if(tick != recordSeenTick){
+        recordSeenTick = tick;
+        if(!recordFull){
+            recordCommitted.store(recordLength, std::memory_order_relaxed);
+            recordTicks.store(tick, std::memory_order_release);
+        }
+        if(tick % RECORD_CHECKPOINT_TICKS == 0){
+            uint32_t hash = record_state_hash(*recordGame);
+            uint8_t payload[4] = { uint8_t(hash), uint8_t(hash >> 8), uint8_t(hash >> 16), uint8_t(hash >> 24) };
+            appendRecord(RECORD_CHECKPOINT, payload, sizeof(payload));
+        }
+    }
+
+    if(!recordSource.nextEvent(recordSource.context, event)) return false;
+    appendRecord(RECORD_BUTTON, &event.button, 1);
+    return true;
+}
+
+uint16_t recordSlider(void *context, uint8_t slider){
+
+    // Every read in a tick sees the same level, so the tick is all a replay needs to know
+    uint32_t tick = recordGame->simulationTicks;
+    if(latchTick[slider] != tick | recordRow[slider] == UINT8_MAX){
+        latchTick[slider] = tick;
+        uint8_t row = sliderRow(recordSource.slider(recordSource.context, slider));
+        latchLevel[slider] = rowSlider(row);
+        if(row != recordRow[slider]){
+            recordRow[slider] = row;
+            appendRecord(slider == INPUT_LEFT ? RECORD_LEFT : RECORD_RIGHT, &row, 1);
+        }
+    }
+    return latchLevel[slider];
+}
+
+uint32_t recordClock(void *context){ return recordSource.clockUs(recordSource.context); }
+
+void record_start(GameState &game, const GameIO &source, const GameRules &rules, uint32_t seed){
+
+    recordGame = &game;
+    recordSource = source;
+    recordLength = 0;
+    recordTick = 0;
+    recordSeenTick = 0;
+    recordFull = false;
+    recordCommitted.store(0, std::memory_order_relaxed);
+    recordTicks.store(0, std::memory_order_release);
+    for(uint8_t s = 0; s < INPUT_SLIDERS; s++) recordRow[s] = UINT8_MAX;
+    describeGame(recordHeader, rules, seed);
+
+    GameIO io = { recordNextEvent, recordSlider, recordClock, nullptr };
+    game_init(game, io, rules, seed);
+}
+
+void record_dump(void (*write)(const void *data, size_t size)){
+
+    RecordHeader header = recordHeader;
+    header.ticks = recordTicks.load(std::memory_order_acquire);
+    header.length = recordCommitted.load(std::memory_order_relaxed);
+    write(&header, sizeof(header));
+    write(recordBuffer, header.length); // Only ever appended to, so the committed bytes don't change under the write
+}
+
+#endif
+
+// Decodes the type and tick of the next record
+void replayNextRecord(Replay &replay){
+
+    if(replay.position >= replay.header.length){ replay.nextTick = UINT32_MAX; return; }
+
+    uint8_t first = replay.records[replay.position++];
+    uint32_t gap = first & 63;
+    if(gap == 63){
+        uint8_t byte;
+        uint8_t shift = 0;
+        do {
+            if(replay.position >= replay.header.length | shift > 28){ replay.corrupt = true; replay.nextTick = UINT32_MAX; return; }
+            byte = replay.records[replay.position++];
+            gap += static_cast<uint32_t>(byte & 0x7F) << shift;
+            shift += 7;
+        } while(byte & 0x80);
+    }
+    replay.nextType = first >> 6;
+    replay.nextTick += gap;
+}
+
+// Applies every record up to the game's current tick
+void replayCatchUp(Replay &replay){
+
+    uint32_t tick = replay.game->simulationTicks;
+    while(replay.nextTick <= tick){
+
+        uint8_t size = replay.nextType == RECORD_CHECKPOINT ? 4 : 1;
+        if(replay.position + size > replay.header.length){ replay.corrupt = true; replay.nextTick = UINT32_MAX; return; }
+        const uint8_t *payload = replay.records + replay.position;
+        replay.position += size;
+
+        switch(replay.nextType){
+            case RECORD_LEFT:
+            case RECORD_RIGHT:
+                replay.rows[replay.nextType == RECORD_LEFT ? INPUT_LEFT : INPUT_RIGHT] = payload[0];
+                break;
+            case RECORD_BUTTON:
+                if(static_cast<uint8_t>(replay.buttonHead - replay.buttonTail) < INPUT_QUEUE_SIZE)
+                    replay.buttons[replay.buttonHead++ % INPUT_QUEUE_SIZE] = payload[0];
+                break;
+            case RECORD_CHECKPOINT: {
+                uint32_t hash = payload[0] | payload[1] << 8 | payload[2] << 16 | static_cast<uint32_t>(payload[3]) << 24;
+                if(hash != record_state_hash(*replay.game) && replay.mismatches++ == 0) replay.firstMismatch = tick;
+                replay.checkpoints++;
+                break;
+            }
+        }
+        replayNextRecord(replay);
+    }
+}
+
+bool replayNextEvent(void *context, InputEvent &event){
+    Replay &replay = *static_cast<Replay*>(context);
+    replayCatchUp(replay);
+    if(replay.buttonTail == replay.buttonHead) return false;
+    event = { replay.buttons[replay.buttonTail++ % INPUT_QUEUE_SIZE], 0 };
+    return true;
+}
+
+uint16_t replaySlider(void *context, uint8_t slider){
+    Replay &replay = *static_cast<Replay*>(context);
+    replayCatchUp(replay);
+    return rowSlider(replay.rows[slider]);
+}
+
+uint32_t replayClock(void *context){
+    Replay &replay = *static_cast<Replay*>(context);
+    return replay.clock.clockUs(replay.clock.context);
+}
+
+bool replay_start(Replay &replay, GameState &game, const uint8_t *data, uint32_t size, const GameIO &clock){
+
+    if(size < sizeof(RecordHeader)) return false;
+    RecordHeader header;
+    memcpy(&header, data, sizeof(header));
+    if(header.magic != RECORD_MAGIC | header.version != RECORD_VERSION | size - sizeof(header) < header.length) return false;
+    if(header.fixedPoint != PONG_FIXED_POINT | header.width != WIDTH_PX | header.height != HEIGHT_PX) return false;
+    if(header.aiDifficulty >= AI_DIFFICULTIES) return false;
+
+    replay = Replay();
+    replay.records = data + sizeof(header);
+    replay.header = header;
+    replay.game = &game;
+    replay.clock = clock;
+    replayNextRecord(replay);
+
+    GameRules rules;
+    rules.beginVelocity = realFromBits(header.beginVelocity);
+    rules.bounceSpeedup = realFromBits(header.bounceSpeedup);
+    rules.aiDifficulty = header.aiDifficulty;
+
+    GameIO io = { replayNextEvent, replaySlider, replayClock, &replay };
+    game_init(game, io, rules, header.seed);
+    return true;
+}
@@ -0,0 +1,104 @@
+/* Copyright 2023 Collin Bollinger
+ *
+ * input_record.h
+ *
+ * Input recorder and replay. With RECORD_ENABLED the device game's input goes through a recorder, which logs the seed,
+ * the rules, every change of the paddle row a slider selects and every button press into a delta encoded stream in
+ * RAM, along with a hash of the game state every RECORD_CHECKPOINT_TICKS ticks. main() dumps the stream over serial
+ * every RECORD_DUMP_MS. Replaying a dump feeds the same inputs back to a game through its GameIO on the same ticks,
+ * so checkButtons() and updatePaddlePositions() see exactly what they saw the first time and the game plays out the
+ * same way, which the checkpoints confirm. host/pong_replay replays a dump as fast as the host goes. A device build
+ * with REPLAY_ENABLED replays the dump compiled into it at normal speed on the panel.
+ */
+
+#ifndef INPUT_RECORD_H
+#define INPUT_RECORD_H
+
+#include "pong.h"
+
+#ifndef RECORD_ENABLED
+#define RECORD_ENABLED 0 // Set to 1 to record the device game's input. Costs RECORD_BUFFER_SIZE bytes of RAM
+#endif
+#ifndef REPLAY_ENABLED
+#define REPLAY_ENABLED 0 // Set to 1 to play the recording in replay_dump.h (written by pong_replay --header) instead
+#endif
+
+static_assert(!(RECORD_ENABLED & REPLAY_ENABLED), "A replay can't be recorded again");
+
+#define RECORD_BUFFER_SIZE 2048 // Bytes of records kept. Recording stops when they are used up. Change as necessary
+#define RECORD_CHECKPOINT_TICKS 5000 // Ticks between state hashes in the stream
+#define RECORD_DUMP_MS 10000 // Time between dumps. Every dump holds the whole recording so far
+
+#define RECORD_MAGIC 0x43455250 // "PREC" in little endian, marks the start of a dump in the serial stream
+#define RECORD_VERSION 1
+
+/* Records follow each other with no padding. Each one starts with a byte holding its RecordType in the top 2 bits and
+ * the ticks since the previous record in the low 6. A gap of 63 ticks or more stores 63 there and the rest of it
+ * follows as a varint, 7 bits per byte, low bits first. Then comes the payload: the paddle row for a slider, the
+ * InputButton for a press, or the 4 byte little endian record_state_hash() for a checkpoint. The first record's gap
+ * is counted from tick 0 */
+enum RecordType : uint8_t { RECORD_LEFT, RECORD_RIGHT, RECORD_BUTTON, RECORD_CHECKPOINT };
+
+// Start of a dump, followed by length bytes of records. All fields are little endian
+struct RecordHeader {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t fixedPoint; // PONG_FIXED_POINT of the recording build. The replay needs the same physics
+    uint16_t width; // Panel the game was played on
+    uint16_t height;
+    uint8_t aiDifficulty; // GameRules of the game
+    uint8_t reserved;
+    uint32_t beginVelocity; // real_t bits
+    uint32_t bounceSpeedup;
+    uint32_t seed;
+    uint32_t ticks; // The records cover every tick before this one
+    uint32_t length;
+};
+
+static_assert(sizeof(RecordHeader) == 32 & sizeof(real_t) == 4, "The dump layout must not have padding");
+
+// Progress of one replay. Every replay has its own, so any number of games can be replayed at once
+struct Replay {
+    const uint8_t *records;
+    uint32_t position; // Next byte of records to decode
+    RecordHeader header;
+    GameState *game;
+    GameIO clock; // Where the game's time comes from. The input comes from the records
+
+    uint32_t nextTick; // Tick of the next record, UINT32_MAX after the last one
+    uint8_t nextType;
+    uint8_t rows[INPUT_SLIDERS]; // Paddle rows the sliders are at
+    uint8_t buttons[INPUT_QUEUE_SIZE]; // Presses of the current tick not handed to the game yet
+    uint8_t buttonHead, buttonTail;
+
+    uint32_t checkpoints; // Checkpoints passed
+    uint32_t mismatches; // Checkpoints where the game had a different state than when it was recorded
+    uint32_t firstMismatch; // Tick of the first mismatch
+    bool corrupt; // The records ran out in the middle of one
+};
+
+/* Hash of the ball, paddles, scores and button states, for the checkpoints */
+uint32_t record_state_hash(const GameState &game);
+
+/* Starts game recording the input it gets from source. Calls game_init() with the recording input in its place */
+void record_start(GameState &game, const GameIO &source, const GameRules &rules, uint32_t seed);
+
+/* Writes the recording so far through write: a RecordHeader and the records of every tick up to the last complete
+ * one. Safe to call from another thread while the game runs */
+void record_dump(void (*write)(const void *data, size_t size));
+
+// Set once the recording ran out of RECORD_BUFFER_SIZE and stopped
+extern bool recordFull;
+
+// Records of the recording so far
+extern uint8_t recordBuffer[RECORD_BUFFER_SIZE];
+
+/* Starts game replaying the dump at data (size bytes, header included). Time comes from clock, the input from the
+ * dump. Returns false without touching game if the dump is incomplete or was recorded with different physics or on a
+ * different panel */
+bool replay_start(Replay &replay, GameState &game, const uint8_t *data, uint32_t size, const GameIO &clock);
+
+/* True once the game has simulated every tick the dump covers */
+inline bool replay_done(const Replay &replay){ return replay.game->simulationTicks >= replay.header.ticks; }
+
+#endif
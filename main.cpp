@@ -4,22 +4,114 @@
  */
  
 #include "pong.h"
+#include "bcm_matrix.h"
+#include "trace.h"
+#include "input_record.h"
+#include "executive.h"
+#include "memory_layout.h"
+#include "mirror.h"
+
+#if TRACE_ENABLED | RECORD_ENABLED | MIRROR_ENABLED
+// Trace and recording dumps and mirror packets are binary, so they go straight to the serial port instead of through
+// stdio's newline conversion
+void writeSerial(const void *data, size_t size){ mbed_file_handle(STDOUT_FILENO)->write(data, size); }
+#endif
+
+#if TRACE_ENABLED | RECORD_ENABLED
+
+#if TRACE_ENABLED
+#define DUMP_MS TRACE_DUMP_MS
+#else
+#define DUMP_MS RECORD_DUMP_MS
+#endif
+
+// Everything that goes out over serial every DUMP_MS
+void serialDump(){
+#if TRACE_ENABLED
+    trace_dump(writeSerial);
+    rgb_matrix_report();
+    memory_report();
+#if MIRROR_ENABLED
+    mirror_report();
+#endif
+#if BCM_ENABLED
+    bcm_report();
+#endif
+#endif
+
+#if RECORD_ENABLED
+    // Every dump holds the whole recording, so the last one received is the one to replay
+    record_dump(writeSerial);
+#endif
+}
+#endif
+
+#if EXECUTIVE_ENABLED
+// The executive's thread. One loop scans the matrix and runs the game in between rows
+void executive(){
+#if TRACE_ENABLED | RECORD_ENABLED
+    executive_run(serialDump, DUMP_MS);
+#else
+    executive_run(nullptr, 0);
+#endif
+}
+#endif
 
 int main()
 {
 
+#if TRACE_ENABLED
+    memory_layout_report();
+#endif
+
+    // Every stack is painted before its thread starts, for the high water marks in memory_report()
+    for (const ThreadStack &stack : threadStacks) stack_paint(stack);
+
+#if EXECUTIVE_ENABLED
+    Thread thread(osPriorityHigh, threadStacks[0].size, threadStacks[0].memory, threadStacks[0].name);
+    thread.start(executive);
+
+    // The executive dumps between frames itself, so the main thread has nothing left to do
+    while (true) {
+        thread_sleep_for(UINT8_MAX);
+    }
+#else
+    // The game is started before either thread, so the matrix thread never sees it half set up
+    simulation_init();
+
     // Create the pong simulation thread and start it
-    Thread thread1(osPriorityHigh, 1024, NULL, "pong_simulation");
+    Thread thread1(osPriorityHigh, threadStacks[0].size, threadStacks[0].memory, threadStacks[0].name);
     thread1.start(simulate);
 
     // Create the rgb matrix thread and start it
-    Thread thread(osPriorityHigh, 1024, NULL, "rgb_matrix");
+    Thread thread(osPriorityHigh, threadStacks[1].size, threadStacks[1].memory, threadStacks[1].name);
     thread.start(rgb_matrix_function);
 
     // Idle the main thread while other threads run
+#if MIRROR_ENABLED & (TRACE_ENABLED | RECORD_ENABLED)
+    uint32_t dumpUs = us_ticker_read();
+#endif
     while (true) {
         
+#if MIRROR_ENABLED
+        // The main thread has the lowest priority, so packets and dumps only go out when the game threads are idle,
+        // and the row interrupt keeps scanning while they do
+        thread_sleep_for(MIRROR_PERIOD_MS);
+        mirror_send(writeSerial);
+#if TRACE_ENABLED | RECORD_ENABLED
+        if (us_ticker_read() - dumpUs >= DUMP_MS * 1000) {
+            dumpUs = us_ticker_read();
+            serialDump();
+        }
+#endif
+#elif TRACE_ENABLED | RECORD_ENABLED
+        // The main thread has the lowest priority, so the dump only goes out when the game threads are idle
+        thread_sleep_for(DUMP_MS);
+        serialDump();
+#else
         // Idle
         thread_sleep_for(UINT8_MAX);
+#endif
     }
+#endif
 }
@@ -0,0 +1,97 @@
+/* Copyright 2023 Collin Bollinger
+ *
+ * memory_layout.cpp
+ */
+
+#include "memory_layout.h"
+#include "bcm_matrix.h"
+#include "multiball.h"
+#include "trace.h"
+#include "input_record.h"
+#include "sprites.h"
+#include "mirror.h"
+
+// RTX needs 8 byte aligned stacks, and the Cortex-M0+ pushes 8 byte aligned exception frames
+#if EXECUTIVE_ENABLED
+alignas(8) unsigned char executiveStack[EXECUTIVE_STACK_SIZE];
+
+const ThreadStack threadStacks[THREAD_STACKS] = {
+    { "executive", executiveStack, EXECUTIVE_STACK_SIZE },
+};
+#else
+alignas(8) unsigned char simulationStack[SIMULATION_STACK_SIZE];
+alignas(8) unsigned char matrixStack[MATRIX_STACK_SIZE];
+
+const ThreadStack threadStacks[THREAD_STACKS] = {
+    { "pong_simulation", simulationStack, SIMULATION_STACK_SIZE },
+    { "rgb_matrix", matrixStack, MATRIX_STACK_SIZE },
+};
+#endif
+
+// Every statically allocated block of the game for the build's flags, sized from the objects themselves. Counters and
+// other single variables aren't listed, they come to a few hundred bytes and are covered by RAM_MBED_OVERHEAD
+constexpr RamBlock ramBlocks[] = {
+#if EXECUTIVE_ENABLED
+    { "executive stack", sizeof(executiveStack) },
+#else
+    { "simulation stack", sizeof(simulationStack) },
+    { "matrix stack", sizeof(matrixStack) },
+#endif
+    { "game state", sizeof(game) },
+    { "published scene", sizeof(snapshotSequence) + sizeof(snapshotWords) },
+    { "drawn scenes", sizeof(renderedScene) + sizeof(bufferScene) + sizeof(bufferValidRows) },
+    { "input", sizeof(inputState) },
+    { "frame buffers", sizeof(frameBuffer) },
+    { "title text", sizeof(titleMask) },
+#if BCM_ENABLED
+    { "bit planes", sizeof(bcmPlanes) },
+#endif
+#if MULTIBALL_ENABLED
+    { "ball arrays", sizeof(balls) },
+    { "ball pixel layers", sizeof(ballPixels) },
+#endif
+#if TRACE_ENABLED
+    { "trace histograms", sizeof(traceHistogram) + sizeof(traceTotals) },
+    { "trace ring", sizeof(traceRing) },
+#endif
+#if RECORD_ENABLED
+    { "input recording", sizeof(recordBuffer) },
+#endif
+#if MIRROR_ENABLED
+    { "frame mirror", sizeof(mirrorRows) },
+#endif
+};
+
+constexpr uint32_t ramTotal(){
+    uint32_t total = 0;
+    for(const RamBlock &block : ramBlocks) total += block.bytes;
+    return total;
+}
+
+// The host stand-ins are bigger than the device's and the host builds try sizes the device can't hold
+#ifndef PONG_HOST
+static_assert(ramTotal() <= RAM_BUDGET, "The game's RAM goes over RAM_BUDGET, see memory_layout_report()");
+#endif
+
+void stack_paint(const ThreadStack &stack){
+    memset(stack.memory, STACK_PAINT, stack.size);
+}
+
+uint32_t stack_high_water(const ThreadStack &stack){
+    uint32_t untouched = STACK_GUARD_BYTES;
+    while(untouched < stack.size && stack.memory[untouched] == STACK_PAINT) untouched++;
+    return stack.size - untouched;
+}
+
+bool memory_layout_report(){
+    // No field widths, so that it works with minimal printf
+    for(const RamBlock &block : ramBlocks) printf("\n\rRAM: %s %u bytes", block.name, (unsigned)block.bytes);
+    printf("\n\rRAM: total %u of the %u bytes mbed-os is estimated to leave, %u of %u with mbed-os",
+           (unsigned)ramTotal(), (unsigned)RAM_BUDGET, (unsigned)(ramTotal() + RAM_MBED), (unsigned)RAM_SIZE);
+    return ramTotal() <= RAM_BUDGET;
+}
+
+void memory_report(){
+    for(const ThreadStack &stack : threadStacks)
+        printf("\n\rStack: %s used %u of %u bytes", stack.name, (unsigned)stack_high_water(stack), (unsigned)stack.size);
+}
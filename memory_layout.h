@@ -0,0 +1,100 @@
+/* Copyright 2023 Collin Bollinger
+ *
+ * memory_layout.h
+ *
+ * Where the game's RAM goes. Nothing is allocated at run time: the game, the frame buffers, the bit planes and every
+ * other buffer are statically sized arrays, and so are the stacks of the game threads, which main() hands to their
+ * Thread objects instead of letting mbed-os take them from the heap. The blocks are listed in one table with their
+ * sizes for the build's flags, and a device build whose blocks don't fit in what the KL25Z's 16 KB is estimated to
+ * leave after mbed-os fails to compile. Part of that estimate, RAM_MBED_OVERHEAD, hasn't been measured, so a build
+ * that passes is not proven to fit, see below.
+ *
+ * Every stack is painted with STACK_PAINT before its thread starts. Stacks grow down, so the paint left at the bottom
+ * is the part that was never used, and memory_report() prints how deep each thread has gone so far. The KL25Z's
+ * Cortex-M0+ has no data cache, so the only alignment that matters is the 8 bytes the stacks need.
+ */
+
+#ifndef MEMORY_LAYOUT_H
+#define MEMORY_LAYOUT_H
+
+#include "pong.h"
+
+#define SIMULATION_STACK_SIZE 1024 // Stack of the simulation thread. Change as necessary
+#define MATRIX_STACK_SIZE 1024 // Stack of the matrix thread. Change as necessary
+#define EXECUTIVE_STACK_SIZE 1536 // Stack of the executive thread, which runs the scan and the simulation. Change as necessary
+
+#define STACK_PAINT 0xCC // Fill of unused stack, the same as the RTX watermark
+#define STACK_GUARD_BYTES 4 // RTX keeps a magic word at the bottom of each stack to detect overflows
+
+#define RAM_SIZE 16384 // SRAM of the KL25Z
+
+// RAM mbed-os takes for itself: the main thread's stack, the stack interrupts run on, the idle and timer threads'
+// stacks and an allowance for RTX's control blocks, mbed-os's own data and the heap stdio uses
+#ifdef MBED_CONF_RTOS_MAIN_THREAD_STACK_SIZE
+#define RAM_MAIN_STACK MBED_CONF_RTOS_MAIN_THREAD_STACK_SIZE
+#else
+#define RAM_MAIN_STACK 4096
+#endif
+#ifdef MBED_CONF_TARGET_BOOT_STACK_SIZE
+#define RAM_ISR_STACK MBED_CONF_TARGET_BOOT_STACK_SIZE
+#else
+#define RAM_ISR_STACK 1024
+#endif
+#ifdef MBED_CONF_RTOS_IDLE_THREAD_STACK_SIZE
+#define RAM_IDLE_STACK MBED_CONF_RTOS_IDLE_THREAD_STACK_SIZE
+#else
+#define RAM_IDLE_STACK 512
+#endif
+#ifdef MBED_CONF_RTOS_TIMER_THREAD_STACK_SIZE
+#define RAM_TIMER_STACK MBED_CONF_RTOS_TIMER_THREAD_STACK_SIZE
+#else
+#define RAM_TIMER_STACK 768
+#endif
+
+// RTX control blocks, the data of mbed-os and its drivers and a minimal heap. This is an estimate that hasn't been
+// measured on a device build, so the check is only as good as it is. To measure it, build with every game flag off
+// and take the .data and .bss totals from the memory summary mbed prints or from the linker map, which include the
+// stacks above. Take away RAM_MAIN_STACK to RAM_TIMER_STACK and the game's own static variables (the blocks in
+// memory_layout_report() plus its counters), then add the heap printf and the drivers allocate at startup, which
+// mbed_stats_heap_get() gives. Builds within a few hundred bytes of RAM_BUDGET, like the trace ones, need checking
+// against the linker map until then. Change as necessary
+#define RAM_MBED_OVERHEAD 1024
+#define RAM_MBED (RAM_MAIN_STACK + RAM_ISR_STACK + RAM_IDLE_STACK + RAM_TIMER_STACK + RAM_MBED_OVERHEAD)
+#define RAM_BUDGET (RAM_SIZE - RAM_MBED) // What the game's blocks may use, as far as RAM_MBED_OVERHEAD is right
+
+// Stack of a game thread
+struct ThreadStack {
+    const char *name; // Name of the thread, as given to its Thread
+    unsigned char *memory;
+    uint32_t size;
+};
+
+#if EXECUTIVE_ENABLED
+#define THREAD_STACKS 1
+#else
+#define THREAD_STACKS 2
+#endif
+
+// The game threads' stacks, in the order main() starts them
+extern const ThreadStack threadStacks[THREAD_STACKS];
+
+// One statically allocated block of the game
+struct RamBlock {
+    const char *name;
+    uint32_t bytes;
+};
+
+/* Fills a stack with STACK_PAINT. Must be called before its thread starts */
+void stack_paint(const ThreadStack &stack);
+
+/* Deepest the stack has been so far in bytes, counted from the top. Only meaningful once it was painted */
+uint32_t stack_high_water(const ThreadStack &stack);
+
+/* Prints every block of the game with its size and the total against RAM_BUDGET. Returns false if they go over it,
+ * which only a host build can get to */
+bool memory_layout_report();
+
+/* Prints how deep each game thread's stack has been so far */
+void memory_report();
+
+#endif
@@ -0,0 +1,125 @@
+/* Copyright 2023 Collin Bollinger
+ *
+ * mirror.cpp
+ */
+
+#include "mirror.h"
+
+MirrorStats mirrorStats;
+
+uint32_t mirror_row_hash(const uint8_t colors[WIDTH_PX]){
+    uint32_t hash = 2166136261u;
+    for(uint8_t x = 0; x < WIDTH_PX; x++){ hash ^= colors[x]; hash *= 16777619u; }
+    return hash;
+}
+
+#if MIRROR_ENABLED
+
+uint32_t mirrorRows[HEIGHT_PX];
+bool mirrorStarted = false; // False until the first keyframe went out
+uint32_t mirrorKeyframeUs = 0; // When the last keyframe went out
+uint16_t mirrorSequence = 0;
+uint64_t mirrorResend = 0; // Rows that were sent from a buffer that was swapped away while it was read
+
+// Byte budget. It fills at MIRROR_BYTES_PER_S up to a second's worth, and a packet can overdraw it, which holds the
+// next packets back until it is paid off
+int32_t mirrorBudget = 0;
+uint32_t mirrorRefillUs = 0;
+
+// Colors of a pixel row of a frame buffer. Rows 0-15 are on the RGB1 lanes and rows 16-31 on the RGB2 lanes
+void readRow(const port_word_t rows[][WIDTH_PX], uint8_t y, uint8_t colors[WIDTH_PX]){
+    const port_word_t *words = rows[y < SCAN_ROWS ? y : y - SCAN_ROWS];
+    uint8_t shift = y < SCAN_ROWS ? PORT_RGB1_SHIFT : PORT_RGB2_SHIFT;
+    for(uint8_t x = 0; x < WIDTH_PX; x++){ colors[x] = words[x] >> shift & 7; }
+}
+
+// Run length encodes a pixel row after its y. Returns the bytes used, at most 1 + WIDTH_PX
+uint8_t encodeRow(uint8_t y, const uint8_t colors[WIDTH_PX], uint8_t *out){
+    uint8_t length = 0;
+    out[length++] = y;
+    for(uint8_t x = 0; x < WIDTH_PX;){
+        uint8_t run = 1;
+        while(x + run < WIDTH_PX && run < 32 && colors[x + run] == colors[x]) run++;
+        out[length++] = (run - 1) << 3 | colors[x];
+        x += run;
+    }
+    return length;
+}
+
+void mirror_send(void (*write)(const void *data, size_t size)){
+
+    uint32_t now = us_ticker_read();
+    int64_t budget = mirrorBudget + static_cast<uint64_t>(now - mirrorRefillUs) * MIRROR_BYTES_PER_S / 1000000;
+    mirrorBudget = budget < MIRROR_BYTES_PER_S ? budget : MIRROR_BYTES_PER_S;
+    mirrorRefillUs = now;
+
+    // The row interrupt can swap the buffer being read here away at any time, and then the matrix thread clears and
+    // draws the next scene into it, so a row read after that can be blank or half drawn. Each row that is sent is
+    // copied once and hashed and encoded from the copy, and if there was a swap, the rows go out again next time
+    uint32_t swaps = bufferSwaps.load(std::memory_order_acquire);
+    bool keyframe = !mirrorStarted || now - mirrorKeyframeUs >= MIRROR_KEYFRAME_MS * 1000;
+    const port_word_t (*rows)[WIDTH_PX] = frameBuffer[frontBuffer];
+    uint8_t colors[WIDTH_PX];
+    uint64_t changedRows = 0;
+    uint8_t changed = 0;
+    for(uint8_t y = 0; y < HEIGHT_PX; y++){
+        readRow(rows, y, colors);
+        if(keyframe || (mirrorResend >> y & 1) || mirror_row_hash(colors) != mirrorRows[y]){
+            changedRows |= 1ull << y;
+            changed++;
+        }
+    }
+    if(changed == 0) return;
+    if(mirrorBudget < 0){
+        mirrorStats.throttled++;
+        return;
+    }
+
+    MirrorHeader header = { MIRROR_MAGIC, MIRROR_VERSION, WIDTH_PX, HEIGHT_PX, changed, mirrorSequence++,
+                            static_cast<uint8_t>(keyframe ? MIRROR_KEYFRAME : 0), 0 };
+    write(&header, sizeof(header));
+
+    uint8_t encoded[1 + WIDTH_PX];
+    uint16_t sum = 0;
+    uint32_t bytes = sizeof(header) + sizeof(sum);
+    for(uint8_t y = 0; y < HEIGHT_PX; y++){
+        if(!(changedRows >> y & 1)) continue;
+        readRow(rows, y, colors);
+        mirrorRows[y] = mirror_row_hash(colors);
+        uint8_t length = encodeRow(y, colors, encoded);
+        for(uint8_t i = 0; i < length; i++) sum += encoded[i];
+        write(encoded, length);
+        bytes += length;
+    }
+    uint8_t trailer[2] = { uint8_t(sum), uint8_t(sum >> 8) };
+    write(trailer, sizeof(trailer));
+    mirrorResend = bufferSwaps.load(std::memory_order_acquire) != swaps ? changedRows : 0;
+
+    mirrorBudget -= bytes;
+    if(keyframe){
+        mirrorStarted = true;
+        mirrorKeyframeUs = now;
+        mirrorStats.keyframes++;
+    }
+    mirrorStats.packets++;
+    mirrorStats.rows += changed;
+    mirrorStats.bytes += bytes;
+    if(bytes > mirrorStats.largestPacket) mirrorStats.largestPacket = bytes;
+}
+
+uint32_t mirror_frame_hash(){
+    uint32_t hash = 2166136261u;
+    for(uint8_t y = 0; y < HEIGHT_PX; y++){
+        for(uint8_t b = 0; b < 4; b++){ hash ^= mirrorRows[y] >> (8 * b) & UINT8_MAX; hash *= 16777619u; }
+    }
+    return hash;
+}
+
+void mirror_report(){
+    uint32_t packets = mirrorStats.packets ? mirrorStats.packets : 1;
+    printf("\n\rMirror: %u packets (%u keyframes), %u rows and %u bytes per packet, largest %u bytes, %u held back",
+           (unsigned)mirrorStats.packets, (unsigned)mirrorStats.keyframes, (unsigned)(mirrorStats.rows / packets),
+           (unsigned)(mirrorStats.bytes / packets), (unsigned)mirrorStats.largestPacket, (unsigned)mirrorStats.throttled);
+}
+
+#endif
@@ -0,0 +1,85 @@
+/* Copyright 2023 Collin Bollinger
+ *
+ * mirror.h
+ *
+ * Frame mirror. With MIRROR_ENABLED, the main thread sends the frame the panel is showing over the serial port every
+ * MIRROR_PERIOD_MS, so the panel can be watched and recorded from a PC without a camera. Only the pixel rows that
+ * changed since the last packet are sent, each run length encoded, and every MIRROR_KEYFRAME_MS all rows are sent so
+ * that a viewer can join at any time. The main thread has the lowest priority and the row interrupt scans the panel,
+ * so writing to the port never holds up the scan, and the packets are held to MIRROR_BYTES_PER_S so they leave the
+ * port time for the trace and recording dumps. host/mirror_view decodes the stream.
+ */
+
+#ifndef MIRROR_H
+#define MIRROR_H
+
+#include "pong.h"
+
+#ifndef MIRROR_ENABLED
+#define MIRROR_ENABLED 0 // Set to 1 to send the panel's frames over the serial port. Change as necessary
+#endif
+
+static_assert(!MIRROR_ENABLED | SCAN_INTERRUPT, "The mirror is sent from the main thread, which only runs while the row interrupt does the scan");
+
+#ifdef MBED_CONF_PLATFORM_STDIO_BAUD_RATE
+#define MIRROR_BAUD MBED_CONF_PLATFORM_STDIO_BAUD_RATE
+#else
+#define MIRROR_BAUD 9600 // Baud rate of the serial port
+#endif
+#define MIRROR_LINK_PERCENT 75 // Share of the serial port the mirror may use. Change as necessary
+#define MIRROR_BYTES_PER_S (MIRROR_BAUD / 10 * MIRROR_LINK_PERCENT / 100) // 10 bits on the line per byte
+#define MIRROR_PERIOD_MS 40 // Time between packets, 25 frames a second. Change as necessary
+#define MIRROR_KEYFRAME_MS 2000 // Time between packets with every row
+
+#define MIRROR_MAGIC 0x52494D50 // "PMIR" in little endian, marks the start of a packet in the serial stream
+#define MIRROR_VERSION 1
+
+#define MIRROR_KEYFRAME 1 // MirrorHeader flag: the packet has every row
+
+/* A packet is a MirrorHeader, then rows times a pixel row: its y (0 is the top row) and its pixels as runs, and then
+ * the 16 bit little endian sum of every byte after the header. A run is one byte with the game color (COLOR_RED etc.)
+ * in bits 0-2 and the run length minus 1 in bits 3-7. The runs of a row add up to width pixels */
+struct MirrorHeader {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t width;
+    uint8_t height;
+    uint8_t rows; // Pixel rows in the packet
+    uint16_t sequence; // Counts packets, so a viewer can tell when one was lost
+    uint8_t flags;
+    uint8_t reserved;
+};
+
+static_assert(sizeof(MirrorHeader) == 12, "The packet layout must not have padding");
+static_assert(WIDTH_PX <= UINT8_MAX && HEIGHT_PX <= 64, "The header holds the panel size in bytes and the changed rows are a 64 bit mask");
+
+// What the mirror sent, for reports and tuning the encoding
+struct MirrorStats {
+    uint32_t packets;
+    uint32_t keyframes;
+    uint32_t rows; // Pixel rows sent
+    uint32_t bytes; // Bytes sent, headers and checksums included
+    uint32_t largestPacket;
+    uint32_t throttled; // Packets held back because the byte budget was used up
+};
+
+extern MirrorStats mirrorStats;
+
+// mirror_row_hash() of every row as the viewer has it
+extern uint32_t mirrorRows[HEIGHT_PX];
+
+/* FNV-1a of a pixel row's colors, WIDTH_PX bytes. The mirror compares rows with it and the viewer uses it for its
+ * frame hash */
+uint32_t mirror_row_hash(const uint8_t colors[WIDTH_PX]);
+
+/* Sends a packet through write with the rows of the front frame buffer that changed since the last one, if there are
+ * any and the byte budget allows. Call every MIRROR_PERIOD_MS from the main thread */
+void mirror_send(void (*write)(const void *data, size_t size));
+
+/* Hash of the frame the viewer has after the last packet: FNV-1a of the mirror_row_hash() of every row, top first */
+uint32_t mirror_frame_hash();
+
+/* Prints the packet counts and bytes per packet */
+void mirror_report();
+
+#endif
@@ -0,0 +1,159 @@
+/* Copyright 2023 Collin Bollinger
+ *
+ * multiball.cpp
+ */
+
+#include "multiball.h"
+#include "trace.h"
+
+// Nothing here is built unless the stress mode is
+#if MULTIBALL_ENABLED
+
+BallArrays balls;
+
+std::atomic<uint32_t> ballPixels[2][MULTIBALL_MAX];
+std::atomic<uint32_t> ballLayerSequence[2];
+uint8_t publishedLayer = 0;
+uint16_t publishedCount = 0;
+
+bool multiballRamping = true;
+uint16_t multiballSustained = 0;
+
+uint32_t multiballUpdateCycles = 0;
+std::atomic<uint32_t> multiballDrawCycles(0);
+
+// Same fixed step as the game ball
+const step_t d_t = SIM_STEP_US / 1000000.0;
+
+// Serves draw from their own generator, so the game's random sequence is the same with or without the extra balls
+uint32_t multiballRandom = 2463534242u;
+
+// Ramp window: ticks into the current ball count and the cycle counters when it started
+uint32_t rampTicks = 0;
+uint32_t rampUpdateStart = 0;
+uint32_t rampDrawStart = 0;
+
+inline uint32_t nextRandom(){
+    multiballRandom ^= multiballRandom << 13;
+    multiballRandom ^= multiballRandom >> 17;
+    multiballRandom ^= multiballRandom << 5;
+    return multiballRandom;
+}
+
+// Puts ball i back in the centre with a random direction and colour, at the game's serve speed
+void serveBall(const GameState &game, uint16_t i){
+    uint32_t r = nextRandom();
+    balls.x_pos[i] = real_t(WIDTH_PX) / 2;
+    balls.y_pos[i] = real_t(HEIGHT_PX) / 2;
+    serveSlopes(r % 255, r & 0x100, game.rules.beginVelocity, balls.x_slope[i], balls.y_slope[i]);
+    balls.color[i] = 1 + (r >> 9) % 7;
+}
+
+void multiball_init(const GameState &game, uint16_t count){
+    balls.count = count < MULTIBALL_MAX ? count : MULTIBALL_MAX;
+    for(uint16_t i = 0; i < balls.count; i++) serveBall(game, i);
+    rampTicks = 0;
+    rampUpdateStart = multiballUpdateCycles;
+    rampDrawStart = multiballDrawCycles.load(std::memory_order_relaxed);
+}
+
+void multiball_update(const GameState &game){
+
+    // Nearly every ball just moves a whole tick. Only the few that would cross a wall or paddle column are swept,
+    // from where they still are
+    for(uint16_t i = 0; i < balls.count; i++){
+        real_t x = balls.x_pos[i] + d_t * balls.x_slope[i];
+        real_t y = balls.y_pos[i] + d_t * balls.y_slope[i];
+        if((y < 0) | (y > HEIGHT_PX) | (x < 1) | (x > WIDTH_PX - 1)){
+            // The same swept contacts as the game ball. A miss goes straight back into play
+            if(sweepBall(balls.x_pos[i], balls.y_pos[i], balls.x_slope[i], balls.y_slope[i], game.leftPaddle.y_idx,
+                         game.rightPaddle.y_idx, game.rules.bounceSpeedup) == SWEEP_MISSED) serveBall(game, i);
+        } else {
+            balls.x_pos[i] = x;
+            balls.y_pos[i] = y;
+        }
+    }
+}
+
+void multiball_tick(const GameState &game){
+
+    TraceStart start = trace_start();
+    multiball_update(game);
+    uint32_t cycles = trace_cycles_since(start);
+    multiballUpdateCycles += cycles;
+    TRACE_VALUE(TRACE_MULTIBALL, cycles);
+
+    if(!multiballRamping || ++rampTicks < MULTIBALL_RAMP_MS * 1000 / SIM_STEP_US) return;
+
+    // Share of the window's cycles spent on the balls. The draw counter is only ever added to, so the difference
+    // covers exactly this window
+    uint64_t used = (multiballUpdateCycles - rampUpdateStart) + (multiballDrawCycles.load(std::memory_order_relaxed) - rampDrawStart);
+    uint64_t window = static_cast<uint64_t>(MULTIBALL_RAMP_MS) * (SystemCoreClock / 1000);
+    uint16_t count = balls.count;
+
+    if(used * 100 > window * MULTIBALL_BUDGET_PERCENT){ // Over budget: settle on the previous count
+        multiballRamping = false;
+        balls.count = count > MULTIBALL_START ? count / 2 : count;
+    } else {
+        multiballSustained = count;
+        uint16_t next = count * 2 <= MULTIBALL_MAX ? count * 2 : MULTIBALL_MAX;
+        if(next == count) multiballRamping = false; // Full
+        for(uint16_t i = count; i < next; i++) serveBall(game, i);
+        balls.count = next;
+    }
+
+    rampTicks = 0;
+    rampUpdateStart = multiballUpdateCycles;
+    rampDrawStart = multiballDrawCycles.load(std::memory_order_relaxed);
+}
+
+// Ball x to the column it is drawn in, the same as the game ball's mapValue_i()
+inline uint8_t ballColumn(real_t x){ return realToInt(x * (WIDTH_PX - 1) / WIDTH_PX + 0.5); }
+inline uint8_t ballRow(real_t y){ return realToInt(y * (HEIGHT_PX - 1) / HEIGHT_PX + 0.5); }
+
+void multiball_publish(GameSnapshot &snapshot){
+
+    uint8_t front = publishedLayer, back = publishedLayer ^ 1;
+    bool changed = balls.count != publishedCount;
+
+    // Write the back layer under its sequence, and compare it with the front one on the way
+    uint32_t sequence = ballLayerSequence[back].load(std::memory_order_relaxed);
+    ballLayerSequence[back].store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for(uint16_t i = 0; i < balls.count; i++){
+        uint32_t pixel = ballColumn(balls.x_pos[i]) | ballRow(balls.y_pos[i]) << 8 | static_cast<uint32_t>(balls.color[i]) << 16;
+        changed |= pixel != ballPixels[front][i].load(std::memory_order_relaxed);
+        ballPixels[back][i].store(pixel, std::memory_order_relaxed);
+    }
+    ballLayerSequence[back].store(sequence + 2, std::memory_order_release);
+
+    // An unchanged layer isn't swapped, so the snapshot stays the same and the display doesn't draw it again
+    if(changed){
+        publishedLayer = back;
+        publishedCount = balls.count;
+    }
+    snapshot.ballCount = publishedCount;
+    snapshot.ballLayer = publishedLayer;
+    snapshot.reserved = 0;
+}
+
+bool multiball_draw(port_word_t rows[][WIDTH_PX], const GameSnapshot &scene){
+
+    TraceStart start = trace_start();
+    uint8_t layer = scene.ballLayer;
+    uint32_t sequence = ballLayerSequence[layer].load(std::memory_order_acquire);
+    bool whole = !(sequence & 1);
+
+    for(uint16_t i = 0; whole & i < scene.ballCount; i++){
+        uint32_t pixel = ballPixels[layer][i].load(std::memory_order_relaxed);
+        uint8_t x = pixel, y = pixel >> 8;
+        if(x < WIDTH_PX & y < HEIGHT_PX) setPixel(rows, x, y, pixel >> 16);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    whole &= ballLayerSequence[layer].load(std::memory_order_relaxed) == sequence;
+
+    multiballDrawCycles.store(multiballDrawCycles.load(std::memory_order_relaxed) + trace_cycles_since(start), std::memory_order_relaxed);
+    return whole;
+}
+
+#endif
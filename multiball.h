@@ -0,0 +1,75 @@
+/* Copyright 2023 Collin Bollinger
+ *
+ * multiball.h
+ *
+ * Multi-ball stress mode. Extra balls bounce off the walls and paddles alongside the game ball, but never score: a
+ * ball that misses a paddle is served again from the centre. They are stored as a structure of arrays and all of them
+ * are moved by one batched update per tick, so the common case of a ball with nothing in its way is a short loop over
+ * four arrays. The stress ramp doubles the number of balls every MULTIBALL_RAMP_MS for as long as moving and drawing
+ * them takes less than MULTIBALL_BUDGET_PERCENT of the CPU, which shows how many balls the board can sustain.
+ *
+ * The display gets the balls as a pixel layer rather than through GameSnapshot. There are two layers, each guarded by
+ * its own sequence number like the snapshot, and the snapshot says which one is current.
+ */
+
+#ifndef MULTIBALL_H
+#define MULTIBALL_H
+
+#include "pong.h"
+
+#ifndef MULTIBALL_MAX
+#define MULTIBALL_MAX 64 // Capacity of the ball arrays, 25 bytes of RAM per ball. Change as necessary
+#endif
+#ifndef MULTIBALL_START
+#define MULTIBALL_START 1 // Balls the stress ramp starts with
+#endif
+#define MULTIBALL_RAMP_MS 2000 // Time the balls get at each count before the ramp decides whether to double them
+#define MULTIBALL_BUDGET_PERCENT 50 // Share of the CPU the balls can use, leaving the rest for the game and the scan
+
+static_assert(MULTIBALL_START >= 1 & MULTIBALL_START <= MULTIBALL_MAX & MULTIBALL_MAX <= UINT16_MAX, "Bad ball counts");
+
+// The extra balls. Element i of every array belongs to ball i
+struct BallArrays {
+    real_t x_pos[MULTIBALL_MAX];
+    real_t y_pos[MULTIBALL_MAX];
+    real_t x_slope[MULTIBALL_MAX];
+    real_t y_slope[MULTIBALL_MAX];
+    uint8_t color[MULTIBALL_MAX];
+    uint16_t count; // Balls in play, the first count elements
+};
+
+extern BallArrays balls;
+
+// Pixel layers for the display. Each pixel is x | y << 8 | color << 16. A layer's sequence is odd while it is written
+extern std::atomic<uint32_t> ballPixels[2][MULTIBALL_MAX];
+extern std::atomic<uint32_t> ballLayerSequence[2];
+
+// Stress ramp state. multiballSustained is the most balls that have stayed within the budget so far
+extern bool multiballRamping;
+extern uint16_t multiballSustained;
+
+// Cycles spent moving and drawing the balls, for the ramp. Each is only written by one thread
+extern uint32_t multiballUpdateCycles;
+extern std::atomic<uint32_t> multiballDrawCycles;
+
+/* Serves count balls from the centre in random directions and colours. Called by simulation_init() with
+ * MULTIBALL_START */
+void multiball_init(const GameState &game, uint16_t count);
+
+/* Moves every ball by one fixed tick, bouncing off the game's paddles. Balls whose path crosses a wall or paddle
+ * column this tick go through sweepBall(), the same as the game ball */
+void multiball_update(const GameState &game);
+
+/* multiball_update() with its cycle count added to multiballUpdateCycles, followed by a step of the stress ramp.
+ * Called from simulation_tick(). There is only one set of extra balls, so this is for the device game */
+void multiball_tick(const GameState &game);
+
+/* Writes the ball pixels into the layer the display isn't using and, if they changed, points snapshot at it. Called
+ * from publishSnapshot() */
+void multiball_publish(GameSnapshot &snapshot);
+
+/* Draws the ball layer a snapshot points at into a frame buffer. Returns false if the simulation wrote the layer
+ * while it was being drawn, in which case the frame buffer has to be drawn again */
+bool multiball_draw(port_word_t rows[][WIDTH_PX], const GameSnapshot &scene);
+
+#endif
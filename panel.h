@@ -0,0 +1,75 @@
+/* Copyright 2023 Collin Bollinger
+ *
+ * panel.h
+ *
+ * Compile time description of the HUB75 panel (or chain of panels) being driven: size, scan ratio, how many panels
+ * are daisy chained and which port C bits the panel's lines are on. Everything is a constant of the Panel type, so
+ * the scan and render loops are built for exactly one geometry and cost the same as hand written ones.
+ *
+ * Select the geometry with the PANEL_* build flags. For example:
+ *   64x32 1:16 (default)                     PANEL_WIDTH=64 PANEL_HEIGHT=32 PANEL_SCAN_ROWS=16
+ *   two 64x32 panels chained into 128x32     PANEL_CHAIN=2
+ *   64x64 1:32                               PANEL_HEIGHT=64 PANEL_SCAN_ROWS=32
+ *   32x16 1:8                                PANEL_WIDTH=32 PANEL_HEIGHT=16 PANEL_SCAN_ROWS=8
+ */
+
+#ifndef PANEL_H
+#define PANEL_H
+
+#include <stdint.h>
+
+#ifndef PANEL_WIDTH
+#define PANEL_WIDTH 64 // Width of one panel in pixels. Change as necessary
+#endif
+#ifndef PANEL_HEIGHT
+#define PANEL_HEIGHT 32 // Height of one panel in pixels. Change as necessary
+#endif
+#ifndef PANEL_SCAN_ROWS
+#define PANEL_SCAN_ROWS 16 // Row select values of the panel, 16 for a 1:16 scan panel. Change as necessary
+#endif
+#ifndef PANEL_CHAIN
+#define PANEL_CHAIN 1 // Panels daisy chained side by side, OUT of one into IN of the next. Change as necessary
+#endif
+
+/* Port bits of the HUB75 lines. Each RGB group is three consecutive bits, blue lowest */
+template <uint8_t Lat, uint8_t Oe, uint8_t Clk, uint8_t RowShift, uint8_t Rgb1Shift, uint8_t Rgb2Shift>
+struct Hub75Lanes {
+    enum {
+        LAT = 1 << Lat,
+        OE = 1 << Oe, // Active low
+        CLK = 1 << Clk,
+        ROW_SHIFT = RowShift, // A-E row select lines start here
+        ROW_MASK = 31 << RowShift,
+        RGB1_SHIFT = Rgb1Shift, // Lanes of the top half of the panel
+        RGB2_SHIFT = Rgb2Shift, // Lanes of the bottom half of the panel
+        RGB_MASK = (7 << Rgb1Shift) | (7 << Rgb2Shift),
+    };
+};
+
+// Wiring of this project: LAT, OE and CLK on PTC0-2, A-E on PTC3-7, B1 G1 R1 on PTC8-10 and B2 G2 R2 on PTC11-13
+typedef Hub75Lanes<0, 1, 2, 3, 8, 11> PortCLanes;
+
+/* Size of the whole display and how it is scanned. Each row select value lights one row in the top half of every
+ * panel, from the RGB1 lanes, and the matching row in the bottom half, from the RGB2 lanes. A chain shifts the columns
+ * of every panel through one after the other, so it scans like one wide panel */
+template <uint16_t Width, uint8_t Height, uint8_t ScanRows, uint8_t Chain, typename LaneMap>
+struct PanelGeometry {
+    typedef LaneMap Lanes;
+
+    enum : uint16_t {
+        WIDTH = Width * Chain, // Columns shifted in for every row
+        HEIGHT = Height,
+        SCAN_ROWS = ScanRows, // Row pairs, and rows of the frame buffer
+        CHAIN = Chain,
+        ROW_BITS = ScanRows <= 8 ? 3 : (ScanRows <= 16 ? 4 : 5), // Row select lines used
+    };
+
+    static_assert(Height == 2 * ScanRows, "Each row select value must light one row on each RGB lane group");
+    static_assert(ScanRows == 8 | ScanRows == 16 | ScanRows == 32, "Scan ratio must be 1:8, 1:16 or 1:32");
+    static_assert(Width * Chain <= 255, "Columns are indexed with uint8_t");
+    static_assert((ScanRows - 1) << LaneMap::ROW_SHIFT < (1 << LaneMap::RGB1_SHIFT), "Row select lines overlap the RGB lanes");
+};
+
+typedef PanelGeometry<PANEL_WIDTH, PANEL_HEIGHT, PANEL_SCAN_ROWS, PANEL_CHAIN, PortCLanes> Panel;
+
+#endif
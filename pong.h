@@ -12,17 +12,40 @@
 #include <math.h>
 #include <random>
 #include <ctime>
+#include <atomic>
+#include "fixed_point.h"
+#include "panel.h"
+#include "pong_input.h"
 
 #define M_PI 3.14159265358979323846
 
 #define BEGIN_VELOCITY 10.0 // Starting velocity of the ball. Change as necessary
+#define BOUNCE_SPEEDUP 2.0 // Speed the ball gains from every paddle bounce. Change as necessary
+#define MAX_VELOCITY 250.0 // Speed the ball stops accelerating at. Also keeps the fixed point physics in range
+
+#define HEIGHT_PX       Panel::HEIGHT // Height of the rgb matrix in pixels. Set by the PANEL_* flags in panel.h
+#define WIDTH_PX        Panel::WIDTH // Width of the rgb matrix (all chained panels) in pixels
+#define SCAN_ROWS       Panel::SCAN_ROWS // Row pairs scanned per frame, half of HEIGHT_PX
+
+#define SIM_STEP_US 1000 // Fixed physics time step in microseconds
+#define SIM_MAX_CATCHUP 20 // Most fixed steps run at once to catch up after the simulation thread was held up
+#define SIM_MAX_CONTACTS 4 // Most wall and paddle contacts resolved within one fixed step
+#if INPUT_LOW_LATENCY
+#define SIM_INPUT_SAMPLE_MS 1 // Longest the event driven simulation sleeps before reading the buttons and sliders again
+#else
+#define SIM_INPUT_SAMPLE_MS 10
+#endif
+
+static_assert(SIM_INPUT_SAMPLE_MS * 1000 / SIM_STEP_US <= SIM_MAX_CATCHUP, "An event driven sleep must not drop ticks");
 
-#define HEIGHT_PX       32 // Height of the rgb matrix in pixels
-#define WIDTH_PX        64 // Width of the rgb matrix in pixels
+#ifndef MULTIBALL_ENABLED
+#define MULTIBALL_ENABLED 0 // Set to 1 for the multi-ball stress mode (multiball.h)
+#endif
 
 #define PADDLE_HEIGHT 8 // The number of pixels that make up the paddle. Change as necessary, cannot exceed HEIGHT / 2 [ceil]
 
-// GPIO register structure
+#ifndef PONG_HOST
+// GPIO register structure. The host build supplies its own recording version of this struct (see host/mbed.h)
 typedef struct {
     uint32_t PDOR; // GPIO output data
     uint32_t PSOR; // Set PDOR bits
@@ -31,13 +54,14 @@ typedef struct {
     uint32_t PDIR; // Data in from GPIO
     uint32_t PDDR; // Specifies pins as I/O
 } GPIO_TypeDef;
+#endif
 
 // Ball struct stores ball properties
 struct Ball {
-  float x_pos; // x_pos and y_pos are the simulation coordinates of the ball
-  float y_pos;
-  float x_slope; // x_slope and y_slope make up the ball's velocity vector
-  float y_slope;
+  real_t x_pos; // x_pos and y_pos are the simulation coordinates of the ball
+  real_t y_pos;
+  real_t x_slope; // x_slope and y_slope make up the ball's velocity vector
+  real_t y_slope;
 
   uint8_t x_int; // Rounded position coordinates
   uint8_t y_int;
@@ -52,14 +76,95 @@ struct Paddle {
 };
 
 
-// Shared variables between threads
-extern Mutex mtx;
-extern Ball *ball;
-extern Paddle *leftPaddle, *rightPaddle;
-extern uint16_t display_score; // 2 bytes for score: Most significant byte is the score for left side and vice versa
-                               // ***This variable doesn't hold the actual score. It holds the values that are currently being
-                               // displayed on screen (set to 0 when a point is in play)
-extern bool showPongText;
+// Compact copy of everything the display needs from the game. The simulation publishes one per step and the display
+// thread reads the latest one without ever taking a lock
+struct GameSnapshot {
+    uint8_t leftPaddleRow; // Row of the lowest pixel in the left paddle
+    uint8_t rightPaddleRow; // Row of the lowest pixel in the right paddle
+    uint16_t displayScore; // Heights of the left and right score bars, see display_score
+    uint8_t ballColor;
+    uint8_t ball_x;
+    uint8_t ball_y;
+    uint8_t showText;
+    uint32_t inputUs; // input_slider_moved_us() of the slider sample behind the latest paddle move, 0 before the first
+#if MULTIBALL_ENABLED
+    uint16_t ballCount; // Extra balls in the published pixel layer
+    uint8_t ballLayer; // Which of the two pixel layers holds them, see multiball.h
+    uint8_t reserved;
+#endif
+};
+
+static_assert(sizeof(GameSnapshot) % sizeof(uint32_t) == 0, "GameSnapshot is copied as whole words");
+
+// Where a game gets its buttons, sliders and time from. The game on the device reads the interrupt driven input in
+// pong_input.h and the simulation thread's Timer. A host tool can give every game its own scripted source instead
+struct GameIO {
+    bool (*nextEvent)(void *context, InputEvent &event); // Oldest button press not handled yet. False if there is none
+    uint16_t (*slider)(void *context, uint8_t slider); // Level of INPUT_LEFT or INPUT_RIGHT, 0 to UINT16_MAX
+    uint32_t (*clockUs)(void *context); // Free running microseconds. Only simulation_step() reads it
+    void *context; // Passed to all three
+};
+
+// Tuning a game is played with
+struct GameRules {
+    real_t beginVelocity; // Speed of a serve
+    real_t bounceSpeedup; // Speed the ball gains from every paddle bounce
+    uint8_t aiDifficulty; // How well the computer plays the right paddle in practice mode, an AiDifficulty (pong_ai.h)
+};
+
+// Computer player state, see pong_ai.h
+struct AiPlayer {
+    uint32_t predictedEvent; // ballEvents when the target was worked out
+    uint8_t targetRow;
+    uint16_t reactionLeft; // Ticks of reaction delay still to wait
+    uint8_t moveLeft; // Ticks until the paddle can move another row
+    uint32_t predictions; // Predictions made so far. There should be one per bounce or serve, not one per tick
+};
+
+// Everything one game of pong is made of. Nothing in the simulation keeps state outside of it, so any number of games
+// can be simulated side by side. Only touched by the thread simulating it: the display thread reads the device game
+// through GameSnapshot
+struct GameState {
+    GameIO io;
+    GameRules rules;
+
+    Ball ball;
+    Paddle leftPaddle, rightPaddle;
+    uint8_t score_left, score_right;
+    uint16_t display_score; // 2 bytes for score: Most significant byte is the score for left side and vice versa
+                            // ***This variable doesn't hold the actual score. It holds the values that are currently
+                            // being displayed on screen (set to 0 when a point is in play)
+    bool showPongText;
+
+    // Button controlled states
+    bool running;
+    bool paused;
+    bool practiceMode;
+
+    // Point timeline: the score flashes between points, timed in simulated microseconds since the point ended
+    bool pointResetting; // True while the point timeline is playing and the ball is waiting to be served
+    uint32_t pointTimelineUs;
+    uint32_t pointShowUs; // How long the scores are shown in each flash
+    uint32_t pointFlashUs; // Length of one flash, shown and then blank
+
+    uint32_t ballEvents; // Bumped on every paddle bounce, miss and serve, so anything that predicts the ball knows to redo
+                         // it. Wall bounces don't change where the ball lands, so they don't count
+    uint32_t random; // Xorshift state for the serves and the computer's aim
+    AiPlayer ai;
+
+    // Fixed step accounting, in microseconds of io.clockUs()
+    uint32_t prevTime;
+    uint32_t stepAccumulator; // Elapsed time not simulated yet
+    uint32_t simulationTicks; // Fixed ticks simulated so far
+    uint32_t droppedTicks; // Ticks skipped because the simulation fell more than SIM_MAX_CATCHUP ticks behind
+    uint32_t simulationWakeups; // Calls to simulation_step()
+};
+
+// The game on the device, simulated by simulate()
+extern GameState game;
+
+// Rules the device game starts with: BEGIN_VELOCITY, BOUNCE_SPEEDUP and AI_DIFFICULTY
+extern const GameRules defaultRules;
 
  /* Takes a floating point value in a floating point range and calculates a mapped integer value between
  * a new set of integer bounds */
@@ -72,39 +177,131 @@ float mapValue_f(float x, float in_min, float in_max, float out_min, float out_m
 /* Return the magnitude of a 2D vector */
 float vectorMagnitude(float x, float y);
 
+/* Fixed point versions of the functions above, used by the physics when PONG_FIXED_POINT is set */
+int mapValue_i(Fix16 x, Fix16 in_min, Fix16 in_max, int out_min, int out_max);
+Fix16 mapValue_f(Fix16 x, Fix16 in_min, Fix16 in_max, Fix16 out_min, Fix16 out_max);
+Fix16 vectorMagnitude(Fix16 x, Fix16 y);
+
+/* Core clock cycles since a SysTick->VAL reading. SysTick counts down from LOAD to 0 once per RTOS tick (1 ms), so
+ * this is only valid for intervals shorter than one tick */
+inline uint32_t systickCyclesSince(uint32_t start){
+    uint32_t now = SysTick->VAL;
+    return start >= now ? start - now : start + (SysTick->LOAD + 1) - now;
+}
+
+// Paddle row in [0, HEIGHT_PX - PADDLE_HEIGHT] a slider level selects. Integer version of
+// mapValue_i(level, 0, UINT16_MAX, 0, HEIGHT_PX - PADDLE_HEIGHT)
+inline uint8_t sliderRow(uint16_t level){
+    return (static_cast<uint32_t>(level) * (HEIGHT_PX - PADDLE_HEIGHT) + UINT16_MAX / 2) / UINT16_MAX;
+}
+
+// A slider level that selects row, the inverse of sliderRow()
+inline uint16_t rowSlider(uint8_t row){ return static_cast<uint32_t>(row) * UINT16_MAX / (HEIGHT_PX - PADDLE_HEIGHT); }
+
+/* Maps the latest level of a slider (INPUT_LEFT or INPUT_RIGHT) from the game's input source to a paddle row in
+ * [0, HEIGHT_PX - PADDLE_HEIGHT] */
+uint8_t readPaddleSlider(GameState &game, uint8_t slider);
+
 /* Reads analog data from the potentiometers and updates the location of the paddle in simulation.
- * If practiceMode == true, this function will not read from the right potentiometer. */
-void updatePaddlePositions();
+ * If practiceMode == true, this function will not read from the right potentiometer: the computer player in
+ * pong_ai.h moves the right paddle instead. */
+void updatePaddlePositions(GameState &game);
+
+/* Increments the magnitude of any ball's direction vector by inc, up to MAX_VELOCITY */
+void incrementSpeed(real_t &x_slope, real_t &y_slope, real_t inc);
+
+/* Sends a ball back off a paddle whose lowest pixel is paddleRow, after it reached the paddle at height y.
+ * The new angle depends on where along the paddle it hit. direction is the sign of the new x_slope, and the ball
+ * speeds up by speedup. Called from sweepBall() */
+void bounceOffPaddle(real_t &x_slope, real_t &y_slope, real_t y, uint8_t paddleRow, int8_t direction, real_t speedup);
 
-/* Increments the magnitude of the ball's direction vector by inc */
-void incrementSpeed(float inc);
+/* Direction vector of a serve at speed. angle (0 to 254) goes from 45 degrees down to 45 degrees up, and left sends
+ * the ball towards the left paddle */
+void serveSlopes(uint8_t angle, bool left, real_t speed, real_t &x_slope, real_t &y_slope);
 
-/* Gets the y-intercept of the ball's direction and x */
-float findBallIntercept(float x);
+/* Next number from the game's own random number generator */
+uint32_t gameRandom(GameState &game);
 
 /* This will reset the point after losing a point. Also called for the initial point to start as well.
- * Waits for waitFor milliseconds before resetting the point, as a way to allow you to see the end of the point */
-void reset_point(uint16_t waitFor);
+ * Starts the point timeline, which flashes the scores for waitFor milliseconds before serving, as a way to allow you
+ * to see the end of the point. Never waits itself: the timeline is advanced by simulation_tick(). With a waitFor of 0
+ * the ball is served straight away */
+void reset_point(GameState &game, uint16_t waitFor);
+
+/* Moves the point timeline on by one fixed tick, updating the flashing score and serving when it is over */
+void advancePointTimeline(GameState &game);
+
+/* Puts the ball back in the centre with a random direction, and the paddles where the sliders are */
+void serve_point(GameState &game);
+
+// What happened to a ball in sweepBall()
+enum SweepResult : uint8_t {
+    SWEEP_FREE,    // It only moved and bounced off the walls
+    SWEEP_BOUNCED, // It bounced off a paddle
+    SWEEP_MISSED,  // It reached a paddle column where the paddle isn't
+};
+
+/* Moves a ball by the fixed time step d_t, bouncing it off the top and bottom walls and off the paddles whose lowest
+ * rows are leftRow and rightRow. Collisions are swept: the ball is moved to the first wall or paddle plane its path
+ * crosses, the contact is resolved and the ball continues for the rest of the step, so it can never pass through a
+ * boundary however fast it goes. A miss stops the ball where it reached the paddle column with its slopes unchanged,
+ * and the caller decides what happens next. Used for the game ball and the extra balls of multiball.h alike */
+SweepResult sweepBall(real_t &x_pos, real_t &y_pos, real_t &x_slope, real_t &y_slope, uint8_t leftRow, uint8_t rightRow,
+                      real_t speedup);
 
 /* The function updateBallState is used to refresh the ball properties. This function 
- * calculates the location of the ball after time step d_t. Collisions with edges will flip
- * the balls direction on that axis. This function is meant to be called internally from simulation_step() function.
- * All collisions are handled inside of this function. Reset_point is called from here when the ball misses a 
- * paddle after a collision */
-void updateBallState();
-
-/* The function simulation_step is used to refresh the pong simulation. This involves tracking
- * the delta time between refreshes, updating the properties of the ball, and updating the paddles.
- * All this function does internally is recalculated d_t and call the updateBallState function. This
- * is important because updateBallState relies on an accurate value of d_t.
- * This functions is meant to be called interally from simulation() function */
-void simulation_step();
-
-/* Read from the buttons and update booleans that represent states controlled by the buttons */
-void checkButtons();
-
-/* The function simulate() loops the simulation step function. This function is run in its own thread from main. 
- * The simulate function is the only function that needs to be run in order for the whole thread to run on its own*/
+ * calculates the location of the ball after the fixed time step d_t with sweepBall(). Collisions with walls will flip
+ * the balls direction on that axis. This function is meant to be called internally from simulation_tick() function.
+ * Reset_point is called from here when the ball misses a paddle, which starts the point timeline */
+void updateBallState(GameState &game);
+
+/* Advances the game by one fixed time step of SIM_STEP_US: reads the buttons and sliders and moves the ball */
+void simulation_tick(GameState &game);
+
+/* The function simulation_step is used to refresh the pong simulation. It measures the time since the previous call
+ * on the game's clock and runs that many fixed simulation ticks (at most SIM_MAX_CATCHUP). The device game then
+ * publishes the new state to the display with publishSnapshot(). This functions is meant to be called interally from
+ * simulate() function */
+void simulation_step(GameState &game);
+
+/* Milliseconds the simulation thread can sleep before something visible can happen: the ball reaching a wall or a
+ * paddle column, the ball or a paddle following it moving to another pixel, the computer's paddle moving, or the next
+ * input sample after SIM_INPUT_SAMPLE_MS. Each event of the ball is a line it crosses, and the ticks until it does are
+ * worked out from its position and slope along one axis. Always at least 1 */
+uint32_t simulation_sleep_ms(const GameState &game);
+
+// Set to sleep for simulation_sleep_ms() between simulation steps instead of waking up every millisecond
+extern bool eventDrivenSimulation;
+
+/* Publishes the current ball, paddles, score and text state of a game as a GameSnapshot. Called at the end of every
+ * simulation step of the device game. Uses a sequence lock, so the only cost to the display thread is an occasional
+ * stale read */
+void publishSnapshot(const GameState &game);
+
+/* Copies the latest published GameSnapshot. Never blocks: returns false without touching snapshot if nothing has been
+ * published yet or the simulation thread is in the middle of publishing, in which case the caller should keep using
+ * the previous snapshot */
+bool readSnapshot(GameSnapshot &snapshot);
+
+// Snapshot seqlock. The sequence is odd while a snapshot is being written
+extern std::atomic<uint32_t> snapshotSequence;
+extern std::atomic<uint32_t> snapshotWords[sizeof(GameSnapshot) / sizeof(uint32_t)];
+
+/* Handles the button presses from the game's input source and updates booleans that represent states controlled by
+ * the buttons */
+void checkButtons(GameState &game);
+
+/* Starts a game over: clears every score and counter, takes the input source, clock and rules, seeds the game's
+ * random number generator and serves the first point */
+void game_init(GameState &game, const GameIO &io, const GameRules &rules, uint32_t seed);
+
+/* Starts the device game with the interrupt driven input, the Timer and defaultRules, seeded from the floating seed
+ * input. Called once by main() before the threads start, or by executive_init(). The host build calls it directly so
+ * that it can drive simulation_step() itself */
+void simulation_init();
+
+/* The function simulate() loops the simulation step function. This function is run in its own thread from main,
+ * once simulation_init() has started the game */
 void simulate();
 
 #endif
@@ -128,9 +325,174 @@ void simulate();
 
 #define GPIOC_BASE      0x400FF080UL // GPIO port register addresses for Port C
 
-/* This function is used to write pixels to the screen. The screen can only display 2 rows at once. This function
- * loops through the rows and writes them to the screen. This is done is a separate thread so that the delay between
- * each row would be uniform. The rgb_matrix_function function is run in its own thread by main */
+#ifndef EXECUTIVE_ENABLED
+#define EXECUTIVE_ENABLED 0 // Set to 1 to run the scan and the game from one loop instead of two threads (executive.h)
+#endif
+
+// Scan the matrix one row per timer interrupt instead of from a busy thread loop. The BCM engine times its own bit
+// planes and the executive fits the game around the scan loop, so they keep the loop. Change as necessary
+#ifndef SCAN_INTERRUPT
+#if (defined(BCM_ENABLED) && BCM_ENABLED) || EXECUTIVE_ENABLED
+#define SCAN_INTERRUPT 0
+#else
+#define SCAN_INTERRUPT 1
+#endif
+#endif
+
+static_assert(!(EXECUTIVE_ENABLED & SCAN_INTERRUPT), "The executive runs the scan loop itself, build it with SCAN_INTERRUPT=0");
+
+#ifndef SCAN_REFRESH_HZ
+#define SCAN_REFRESH_HZ 200 // Full frames per second the scan starts with. Change as necessary
+#endif
+#ifndef SCAN_BRIGHTNESS
+#define SCAN_BRIGHTNESS 255 // Brightness the scan starts with, see ScanSchedule. Change as necessary
+#endif
+#define SCAN_ROW_US (1000000 / (SCAN_REFRESH_HZ * SCAN_ROWS)) // Time between rows at SCAN_REFRESH_HZ
+#define SCAN_MIN_ROW_US 50 // Shortest row period that leaves time to shift a row in
+#define SCAN_MAX_REFRESH_HZ (1000000 / (SCAN_MIN_ROW_US * SCAN_ROWS))
+#define SCAN_MIN_REFRESH_HZ 60 // Refresh rate below which the panel visibly flickers
+
+static_assert(SCAN_ROW_US >= SCAN_MIN_ROW_US, "SCAN_REFRESH_HZ leaves too little time per row to shift it in");
+static_assert(SCAN_REFRESH_HZ >= SCAN_MIN_REFRESH_HZ, "SCAN_REFRESH_HZ flickers");
+static_assert(SCAN_BRIGHTNESS >= 0 & SCAN_BRIGHTNESS <= UINT8_MAX, "SCAN_BRIGHTNESS is a level from 0 to 255");
+
+// Port C bit positions of the matrix pins, from the lane map of the panel (PortCLanes in panel.h)
+#define PORT_LAT        Panel::Lanes::LAT
+#define PORT_OE         Panel::Lanes::OE // Active low
+#define PORT_CLK        Panel::Lanes::CLK
+#define PORT_ROW_SHIFT  Panel::Lanes::ROW_SHIFT
+#define PORT_ROW_MASK   Panel::Lanes::ROW_MASK
+#define PORT_RGB1_SHIFT Panel::Lanes::RGB1_SHIFT
+#define PORT_RGB2_SHIFT Panel::Lanes::RGB2_SHIFT
+#define PORT_RGB_MASK   Panel::Lanes::RGB_MASK
+
+// Frame buffer bits above the lanes that mark the RGB1 or RGB2 pixel of a port word as dimmed. Only the BCM engine
+// shows them, by giving a dimmed color its own darker palette entry in bcm_load_frame(). A pixel is therefore one of
+// 16 palette entries, 7 colors full and dimmed, rather than a free intensity per channel, which would take 3 bytes per
+// pixel and doesn't fit in RAM. That is the intended scope: every build draws the same scene, and the BCM build only
+// shows the score bars dimmed, where the other scans show them at full intensity
+#define PORT_DIM1       (1 << (PORT_RGB2_SHIFT + 3))
+#define PORT_DIM2       (PORT_DIM1 << 1)
+
+// One column of one row pair, already shifted into its port C position. Only RGB1 and RGB2 bits are ever set, and the
+// dim bits for the BCM engine, which scans its bit planes instead
+typedef uint16_t port_word_t;
+
+static_assert(PORT_DIM2 <= 1 << (8 * sizeof(port_word_t) - 1), "The dim bits must fit in a port word");
+
+// Frame buffers holding a port word for every column of every row pair. The scan loop streams the front buffer
+// while a changed scene is drawn into the back buffer, and the two are swapped at a frame boundary. The thread loop
+// draws in between frames, when nothing is being scanned out, so it makes do with one buffer, 2 KB less of RAM on a
+// 64x32 panel. The multi-ball layer can make a scene be drawn again, so it keeps the back buffer
+#if SCAN_INTERRUPT || EXECUTIVE_ENABLED || MULTIBALL_ENABLED
+#define FRAME_BUFFERS 2
+#else
+#define FRAME_BUFFERS 1
+#endif
+
+static_assert(!INPUT_LOW_LATENCY | SCAN_INTERRUPT | EXECUTIVE_ENABLED, "The low latency fast path runs in rgb_matrix_render(), which the thread loop doesn't call");
+extern port_word_t frameBuffer[FRAME_BUFFERS][SCAN_ROWS][WIDTH_PX];
+extern uint8_t frontBuffer;
+extern std::atomic<uint32_t> bufferSwaps; // Swaps so far, so a reader of the front buffer can tell it was swapped away
+
+// Buffer new scenes are drawn into. The front buffer itself when there is only one
+inline uint8_t backBuffer(){ return frontBuffer ^ (FRAME_BUFFERS - 1); }
+
+// Port C register block the matrix is driven through
+extern volatile GPIO_TypeDef *GPIOC;
+
+/* Row timing of the scan. Every row gets the same rowUs slot and is lit for litUs of it, brightness / 255 of the slot,
+ * then blanked until the next row, so the panel is equally bright on every row whatever is on it and draws less
+ * current at lower brightness. The BCM engine scales the on time of its bit planes by brightness instead, and as its
+ * planes at full weight take longer than a row slot above a certain refresh rate, a higher refresh rate lowers the
+ * brightness it can have */
+struct ScanSchedule {
+    uint16_t refreshHz; // Full frames per second
+    uint8_t brightness; // 0 (off) to 255
+    uint32_t rowUs; // Time between rows
+    uint32_t litUs; // Time each row is lit for in its slot
+};
+
+// Schedule the scan is running with
+extern ScanSchedule scanSchedule;
+
+// Running totals of what the scan achieved, updated by the scan as it goes
+struct ScanStats {
+    uint32_t frames;
+    uint32_t litUs; // Time any row was lit
+};
+
+extern ScanStats scanStats;
+
+// Running totals of the scene drawing, updated by the matrix thread or the executive
+struct RenderStats {
+    uint32_t scenes; // Scenes drawn into a frame buffer
+    uint32_t rows; // Frame buffer rows drawn for them, out of SCAN_ROWS per scene
+};
+
+extern RenderStats renderStats;
+
+/* Asks for a new refresh rate and brightness, applied by the scan at the start of its next frame. The refresh rate
+ * is clamped to [SCAN_MIN_REFRESH_HZ, SCAN_MAX_REFRESH_HZ] and the brightness to what fits in a row at that refresh
+ * rate. Returns the schedule that will be used. Safe to call from any thread */
+ScanSchedule rgb_matrix_set_scan(uint16_t refreshHz, uint8_t brightness);
+
+/* Prints the schedule and the refresh rate and duty cycle achieved since the last report, and the frame buffer rows
+ * drawn per scene and per frame. Called by the main thread after each trace dump */
+void rgb_matrix_report();
+
+/* This function is used to write pixels to the screen. The screen can only display 2 rows at once. With
+ * SCAN_INTERRUPT set, a timer interrupt shifts out one row every scanSchedule.rowUs and this thread only draws new
+ * scenes into the back buffer. Otherwise this function loops through the rows and writes them to the screen itself.
+ * The rgb_matrix_function function is run in its own thread by main */
 void rgb_matrix_function();
 
+/* Clears the matrix pins and draws the title layer. Called once by rgb_matrix_function() before its loop */
+void rgb_matrix_init();
+
+/* Starts the row interrupt. Called by rgb_matrix_function() after rgb_matrix_init() when SCAN_INTERRUPT is set */
+void rgb_matrix_start_scan();
+
+/* Row interrupt handler: shifts in the next row of the front buffer with the panel blanked, latches it and lights it
+ * for scanSchedule.litUs. After the last row of a frame, swaps in the back buffer if rgb_matrix_render() left a new
+ * scene in it */
+void rgb_matrix_scan_tick();
+
+/* Draws the latest game state into the back buffer for the scan to swap in at its next frame. Does nothing if the game
+ * state hasn't changed, and returns false without looking at it while a swap is still pending. One iteration of the
+ * rgb_matrix_function() loop when SCAN_INTERRUPT is set */
+bool rgb_matrix_render();
+
+/* Scans every row of the matrix once, one row every scanSchedule.rowUs, so it takes a whole frame period. This is one
+ * iteration of the rgb_matrix_function() loop. If the game state changed since the last frame, the new scene is drawn
+ * into the back buffer and swapped in before scanning. With EXECUTIVE_ENABLED, the executive draws new scenes in the
+ * idle part of the row slots instead and they are swapped in here */
+void rgb_matrix_frame();
+
+/* Blanks the panel after the row the scan loop latched last, and keeps it blank while the next row is shifted in */
+void rgb_matrix_blank();
+
+// Light pixel (x, y) in a frame buffer. Rows 0-15 are on the RGB1 lanes and rows 16-31 on the RGB2 lanes
+inline void setPixel(port_word_t rows[][WIDTH_PX], uint8_t x, uint8_t y, uint8_t color){
+    if (y < SCAN_ROWS) { rows[y][x] |= color << PORT_RGB1_SHIFT; }
+    else { rows[y - SCAN_ROWS][x] |= color << PORT_RGB2_SHIFT; }
+}
+
+/* Draws a scene into a frame buffer (SCAN_ROWS rows of port words). Only the frame buffer rows set in dirtyRows (bit r
+ * for row r) are cleared and drawn, the others are left as they are */
+void renderScene(const GameSnapshot &scene, port_word_t rows[][WIDTH_PX], uint32_t dirtyRows = UINT32_MAX);
+
+// Scene most recently drawn, and the scene each frame buffer was last drawn with and the rows that still hold it
+extern GameSnapshot renderedScene;
+extern GameSnapshot bufferScene[FRAME_BUFFERS];
+extern uint32_t bufferValidRows[FRAME_BUFFERS];
+
+/* Frame buffer rows, as a mask with bit r for row r, in which a frame buffer holding the scene drawn has to be drawn
+ * again to hold scene. Worked out from the old and new paddle rows, ball, score bars and text rather than the pixels */
+uint32_t sceneDirtyRows(const GameSnapshot &drawn, const GameSnapshot &scene);
+
+/* The scan kernel: shifts one row of port words into the panel while the previous row stays lit, then latches it.
+ * row_counter is the frame buffer row, 0 to SCAN_ROWS - 1 */
+void rgb_matrix_scan_row(const port_word_t columns[WIDTH_PX], uint8_t row_counter);
+
 #endif
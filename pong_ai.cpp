@@ -0,0 +1,77 @@
+/* Copyright 2023 Collin Bollinger
+ *
+ * pong_ai.cpp
+ */
+
+#include "pong_ai.h"
+
+// reactionTicks, ticksPerRow, aimError. A rally at full speed crosses the panel in about a quarter of a second
+const AiPreset aiPresets[AI_DIFFICULTIES] = {
+    { 250, 40, 4 }, // AI_EASY: 25 rows a second, often aims off the ball
+    { 150, 20, 2 }, // AI_NORMAL: 50 rows a second
+    { 60, 10, 1 },  // AI_HARD: 100 rows a second
+    { 0, 1, 0 },    // AI_PERFECT: a row every tick, never misses
+};
+
+void ai_init(GameState &game){
+    game.ai.predictedEvent = game.ballEvents - 1;
+    game.ai.targetRow = (HEIGHT_PX - PADDLE_HEIGHT) / 2;
+    game.ai.reactionLeft = 0;
+    game.ai.moveLeft = 0;
+}
+
+real_t predictBallLanding(const GameState &game, real_t x){
+
+    const Ball *ball = &game.ball;
+
+    // Unfold the walls: the ball travels in a straight line through mirrored copies of the playing field, so its
+    // height on that line only has to be folded back into [0, HEIGHT_PX] once
+    real_t period = real_t(2 * HEIGHT_PX);
+    real_t y = ball->y_pos + ball->y_slope / ball->x_slope * (x - ball->x_pos);
+    while(y < 0) y += period;
+    while(y >= period) y -= period;
+    return y > HEIGHT_PX ? period - y : y;
+}
+
+// New target for the paddle after the ball bounced off a paddle or was served. The landing already folds in the wall
+// bounces on the way, so those don't start a new reaction delay or a new aim error
+void predict(GameState &game){
+
+    const AiPreset &preset = aiPresets[game.rules.aiDifficulty];
+    int row;
+
+    if(game.ball.x_slope > 0){ // Coming this way: line the middle of the paddle up with where the ball lands
+        // Half a pixel down, the same as the paddle test in updateBallState()
+        uint8_t y_idx = mapValue_i(predictBallLanding(game, WIDTH_PX - 1) + real_t(0.5), 0, HEIGHT_PX, 0, HEIGHT_PX - 1);
+        row = y_idx - PADDLE_HEIGHT / 2;
+        if(preset.aimError) row += gameRandom(game) % (2 * preset.aimError + 1) - preset.aimError;
+    } else { // Going away or waiting for the serve: back to the middle
+        row = (HEIGHT_PX - PADDLE_HEIGHT) / 2;
+    }
+
+    AiPlayer &ai = game.ai;
+    ai.targetRow = row < 0 ? 0 : (row > HEIGHT_PX - PADDLE_HEIGHT ? HEIGHT_PX - PADDLE_HEIGHT : row);
+    ai.reactionLeft = preset.reactionTicks;
+    ai.predictedEvent = game.ballEvents;
+    ai.predictions++;
+}
+
+uint8_t ai_paddle_row(GameState &game, uint8_t row){
+
+    AiPlayer &ai = game.ai;
+    if(ai.predictedEvent != game.ballEvents) predict(game);
+
+    if(ai.reactionLeft) { ai.reactionLeft--; return row; }
+    if(ai.moveLeft) { ai.moveLeft--; return row; }
+    if(row == ai.targetRow) return row;
+
+    ai.moveLeft = aiPresets[game.rules.aiDifficulty].ticksPerRow - 1;
+    return row < ai.targetRow ? row + 1 : row - 1;
+}
+
+uint32_t ai_ticks_until_move(const GameState &game){
+    const AiPlayer &ai = game.ai;
+    if(ai.predictedEvent != game.ballEvents) return 1; // Hasn't seen the latest bounce yet
+    if(game.rightPaddle.y_idx == ai.targetRow) return UINT32_MAX;
+    return ai.reactionLeft + ai.moveLeft + 1;
+}
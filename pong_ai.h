@@ -0,0 +1,46 @@
+/* Copyright 2023 Collin Bollinger
+ *
+ * pong_ai.h
+ *
+ * Computer player for the right paddle in practice mode. Whenever the ball bounces off a paddle or is served, the AI
+ * works out where it will reach the right paddle column by folding the wall reflections into one straight line, and
+ * caches that target. Every tick after that it only counts down its reaction delay and steps the paddle one row towards the target
+ * at the speed of its difficulty preset, so a tick costs a table lookup and a compare.
+ */
+
+#ifndef PONG_AI_H
+#define PONG_AI_H
+
+#include "pong.h"
+
+enum AiDifficulty : uint8_t { AI_EASY, AI_NORMAL, AI_HARD, AI_PERFECT, AI_DIFFICULTIES };
+
+#ifndef AI_DIFFICULTY
+#define AI_DIFFICULTY AI_NORMAL // Difficulty in defaultRules. Change as necessary
+#endif
+
+// How a difficulty plays. The state of the player itself is the AiPlayer in GameState
+struct AiPreset {
+    uint16_t reactionTicks; // Ticks after a bounce before the paddle starts moving to the new target
+    uint8_t ticksPerRow; // Ticks the paddle takes to move one row, 1 / speed
+    uint8_t aimError; // The paddle aims up to this many rows away from where the ball will land
+};
+
+extern const AiPreset aiPresets[AI_DIFFICULTIES];
+
+/* Forgets any target, so the first call to ai_paddle_row() makes a new prediction. Called from game_init() */
+void ai_init(GameState &game);
+
+/* Where the game's ball will be when it reaches column x, in simulation coordinates, with every top and bottom wall
+ * bounce on the way folded in. Only meaningful if the ball is moving towards x */
+real_t predictBallLanding(const GameState &game, real_t x);
+
+/* Next row of the game's right paddle, which is at row now. Called every tick from updatePaddlePositions() in
+ * practice mode */
+uint8_t ai_paddle_row(GameState &game, uint8_t row);
+
+/* Ticks until ai_paddle_row() next moves the paddle, or UINT32_MAX if it is waiting for the next bounce. For
+ * simulation_sleep_ms() */
+uint32_t ai_ticks_until_move(const GameState &game);
+
+#endif
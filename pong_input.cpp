@@ -0,0 +1,146 @@
+/* Copyright 2023 Collin Bollinger
+ *
+ * pong_input.cpp
+ */
+
+#include "pong_input.h"
+#include "pong.h"
+
+InterruptIn ResetButton(PTA1); // Reset button
+InterruptIn PauseButton(PTA2); // Pause/Play button
+InterruptIn PlayerButton(PTD4); // One/Two players
+
+Ticker sliderTicker;
+
+InputState inputState;
+uint32_t droppedInputEvents = 0;
+
+void buttonEdge(uint8_t button, bool pressed){
+
+    uint32_t now = us_ticker_read();
+    uint32_t quiet = now - inputState.buttonEdgeTime[button];
+    inputState.buttonEdgeTime[button] = now;
+
+    // Contact bounce shows up as a burst of edges, on press and on release. Only a press after the line has been quiet
+    // for the whole debounce time is real
+    if(!pressed | quiet < INPUT_DEBOUNCE_US) return;
+
+    uint8_t head = inputState.inputHead.load(std::memory_order_relaxed);
+    if(static_cast<uint8_t>(head - inputState.inputTail.load(std::memory_order_acquire)) == INPUT_QUEUE_SIZE){
+        droppedInputEvents++;
+        return;
+    }
+    inputState.inputQueue[head % INPUT_QUEUE_SIZE] = { button, now };
+    inputState.inputHead.store(head + 1, std::memory_order_release);
+}
+
+// The buttons pull their line low while pressed
+void resetPressed(){ buttonEdge(INPUT_RESET, true); }
+void resetReleased(){ buttonEdge(INPUT_RESET, false); }
+void pausePressed(){ buttonEdge(INPUT_PAUSE, true); }
+void pauseReleased(){ buttonEdge(INPUT_PAUSE, false); }
+void playerPressed(){ buttonEdge(INPUT_PLAYER, true); }
+void playerReleased(){ buttonEdge(INPUT_PLAYER, false); }
+
+// Averages the conversions of a sample of every slider and passes it through the filter
+void filterSamples(){
+    for(uint8_t s = 0; s < INPUT_SLIDERS; s++){
+        uint32_t sample = inputState.sliderSum[s] / INPUT_OVERSAMPLE;
+        inputState.sliderSum[s] = 0;
+        // Unsigned wrap around keeps this right when the sample is below the filtered level
+        inputState.sliderFilter[s] += sample - (inputState.sliderFilter[s] >> INPUT_FILTER_SHIFT);
+        uint16_t level = inputState.sliderFilter[s] >> INPUT_FILTER_SHIFT;
+        inputState.sliderLevel[s].store(level, std::memory_order_relaxed);
+
+        // Timestamp the sample the paddle moves with
+        if(sliderRow(level) != inputState.sliderRows[s]){
+            inputState.sliderRows[s] = sliderRow(level);
+            inputState.sliderMoved[s].store(inputState.sliderSampleStart, std::memory_order_relaxed);
+        }
+    }
+}
+
+#ifdef PONG_HOST
+// The host has no ADC to start, so the conversion is taken when it is started
+uint16_t adcValue;
+inline void adcStart(analogin_t *adc){ adcValue = analogin_read_u16(adc); }
+inline bool adcDone(){ return true; }
+inline uint16_t adcResult(){ return adcValue; }
+#else
+// analogin_read_u16() starts a conversion and spins until it is done, with the hardware averaging analogin_init() set
+// up. The sampling interrupt starts one here and collects it on its next run instead. The channel bit that selects
+// the b multiplexer is CHANNELS_A_SHIFT in mbed's analogin_api.c
+#define ADC_MUX_B (1 << 5)
+inline void adcStart(analogin_t *adc){
+    if(adc->adc & ADC_MUX_B) { ADC0->CFG2 |= ADC_CFG2_MUXSEL_MASK; }
+    else { ADC0->CFG2 &= ~ADC_CFG2_MUXSEL_MASK; }
+    ADC0->SC1[0] = ADC_SC1_ADCH(adc->adc & ~ADC_MUX_B);
+}
+inline bool adcDone(){ return ADC0->SC1[0] & ADC_SC1_COCO_MASK; }
+inline uint16_t adcResult(){ return ADC0->R[0]; } // Reading it clears COCO
+#endif
+
+// Runs every INPUT_SAMPLE_US and never waits for the ADC: it collects the conversion the last run started and starts
+// the next one, taking turns between the sliders
+void sampleSliders(){
+
+    uint8_t &conversions = inputState.sliderConversions;
+    if(inputState.sliderConverting){
+        if(!adcDone()) return; // Still converting, look again next time
+        inputState.sliderSum[conversions % INPUT_SLIDERS] += adcResult();
+        inputState.sliderConverting = false;
+        if(++conversions == INPUT_SLIDERS * INPUT_OVERSAMPLE){
+            conversions = 0;
+            filterSamples();
+        }
+    }
+
+    if(conversions == 0) inputState.sliderSampleStart = us_ticker_read();
+    adcStart(&inputState.sliderAdc[conversions % INPUT_SLIDERS]);
+    inputState.sliderConverting = true;
+}
+
+void input_init(){
+
+    sliderTicker.detach();
+
+    analogin_init(&inputState.sliderAdc[INPUT_LEFT], PTB0);
+    analogin_init(&inputState.sliderAdc[INPUT_RIGHT], PTB1);
+
+    // Start the filter at the current position instead of sliding up from 0
+    for(uint8_t s = 0; s < INPUT_SLIDERS; s++){
+        uint16_t sample = analogin_read_u16(&inputState.sliderAdc[s]);
+        inputState.sliderSum[s] = 0;
+        inputState.sliderFilter[s] = static_cast<uint32_t>(sample) << INPUT_FILTER_SHIFT;
+        inputState.sliderLevel[s].store(sample, std::memory_order_relaxed);
+        inputState.sliderRows[s] = sliderRow(sample);
+    }
+    inputState.sliderConversions = 0;
+    inputState.sliderConverting = false;
+
+    // Presses from before the game started don't count
+    inputState.inputTail.store(inputState.inputHead.load(std::memory_order_acquire), std::memory_order_release);
+
+    ResetButton.fall(&resetPressed);
+    ResetButton.rise(&resetReleased);
+    PauseButton.fall(&pausePressed);
+    PauseButton.rise(&pauseReleased);
+    PlayerButton.fall(&playerPressed);
+    PlayerButton.rise(&playerReleased);
+
+    sliderTicker.attach(&sampleSliders, std::chrono::microseconds(INPUT_SAMPLE_US));
+}
+
+bool input_next_event(InputEvent &event){
+
+    uint8_t tail = inputState.inputTail.load(std::memory_order_relaxed);
+    if(tail == inputState.inputHead.load(std::memory_order_acquire)) return false;
+
+    event = inputState.inputQueue[tail % INPUT_QUEUE_SIZE];
+    inputState.inputTail.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+uint16_t input_slider(uint8_t slider){ return inputState.sliderLevel[slider].load(std::memory_order_relaxed); }
+
+uint32_t input_slider_moved_us(uint8_t slider){ return inputState.sliderMoved[slider].load(std::memory_order_relaxed); }
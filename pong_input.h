@@ -0,0 +1,81 @@
+/* Copyright 2023 Collin Bollinger
+ *
+ * pong_input.h
+ *
+ * Interrupt driven buttons and background slider sampling. The buttons post debounced press events to a queue from
+ * their edge interrupts, and a Ticker interrupt samples, averages and filters the sliders. The simulation thread only
+ * drains the queue and reads the latest slider levels, so it never waits on a pin or the ADC.
+ */
+
+#ifndef PONG_INPUT_H
+#define PONG_INPUT_H
+
+#include "mbed.h"
+#include <atomic>
+
+#define INPUT_DEBOUNCE_US 50000 // A press only counts once its button line has been quiet this long. Change as necessary
+#define INPUT_SAMPLE_US 500 // Period of the slider sampling interrupt, which starts one conversion each time
+#define INPUT_OVERSAMPLE 4 // Conversions of each slider averaged into one slider sample
+#define INPUT_FILTER_SHIFT 2 // Low pass filter on the slider samples: level += (sample - level) / 2^INPUT_FILTER_SHIFT
+#define INPUT_QUEUE_SIZE 8 // Button presses that can wait for the simulation thread. Must be a power of 2
+
+#ifndef INPUT_LOW_LATENCY
+#define INPUT_LOW_LATENCY 0 // Set to 1 to get slider moves onto the panel as soon as possible, see README. Change as necessary
+#endif
+
+static_assert((INPUT_QUEUE_SIZE & (INPUT_QUEUE_SIZE - 1)) == 0 & INPUT_QUEUE_SIZE < 256, "The queue indexes wrap as uint8_t");
+
+enum InputButton : uint8_t { INPUT_RESET, INPUT_PAUSE, INPUT_PLAYER, INPUT_BUTTONS };
+enum InputSlider : uint8_t { INPUT_LEFT, INPUT_RIGHT, INPUT_SLIDERS };
+
+// A debounced button press and when it happened, from us_ticker_read()
+struct InputEvent {
+    uint8_t button;
+    uint32_t time_us;
+};
+
+// Everything the input interrupts keep, in one block so that memory_layout.cpp sizes the real thing
+struct InputState {
+    // AnalogIn takes a mutex, which can't be done from an interrupt, so the sliders are read through the HAL directly
+    analogin_t sliderAdc[INPUT_SLIDERS];
+
+    // Slider sampling state. Only touched by the sampling interrupt after input_init()
+    uint32_t sliderSum[INPUT_SLIDERS];
+    uint8_t sliderConversions; // Conversions summed into the sample so far, taking turns between the sliders
+    bool sliderConverting; // A conversion was started and not collected yet
+    uint32_t sliderFilter[INPUT_SLIDERS]; // Filtered level with INPUT_FILTER_SHIFT extra fraction bits
+    uint32_t sliderSampleStart; // When the first conversion of the sample being summed was taken
+    uint8_t sliderRows[INPUT_SLIDERS]; // Paddle row the filtered level selects
+
+    std::atomic<uint16_t> sliderLevel[INPUT_SLIDERS];
+    std::atomic<uint32_t> sliderMoved[INPUT_SLIDERS];
+
+    // Last edge seen on each button line, for the debounce
+    uint32_t buttonEdgeTime[INPUT_BUTTONS];
+
+    // Single producer, single consumer queue of button presses. The button interrupts all run at the same priority so
+    // they never interrupt each other and together are the only producer, and the simulation thread is the only consumer
+    InputEvent inputQueue[INPUT_QUEUE_SIZE];
+    std::atomic<uint8_t> inputHead; // Written by the button interrupts
+    std::atomic<uint8_t> inputTail; // Written by the simulation thread
+};
+
+extern InputState inputState;
+
+/* Takes the first slider readings and attaches the button and sampling interrupts. Called from simulation_init() */
+void input_init();
+
+/* Takes the oldest button press off the queue. Returns false if there is none. Only call from the simulation thread */
+bool input_next_event(InputEvent &event);
+
+/* Latest filtered level of a slider, 0 to UINT16_MAX. Never waits for a conversion */
+uint16_t input_slider(uint8_t slider);
+
+/* When the first conversion of the sample that last moved a slider's filtered level onto another paddle row was
+ * taken, from us_ticker_read(). The start of the slider to photon latency */
+uint32_t input_slider_moved_us(uint8_t slider);
+
+// Presses lost because the queue was full
+extern uint32_t droppedInputEvents;
+
+#endif
@@ -4,43 +4,44 @@
 */
  
 #include "pong.h"
+#include "pong_input.h"
+#include "pong_ai.h"
+#include "multiball.h"
+#include "input_record.h"
+#include "trace.h"
+
+#if REPLAY_ENABLED
+#include "replay_dump.h" // const uint8_t replayDump[], written by pong_replay --header
+#endif
 
-AnalogIn Left(PTB0);
-AnalogIn Right(PTB1);
 AnalogIn seed(PTB2);
 
-DigitalIn Reset(PTA1); // Reset button
-DigitalIn Pause(PTA2); // Pause/Play button
-DigitalIn PlayerChange(PTD4); // One/Two players
+bool eventDrivenSimulation = false;
 
-bool measurePerformance_simulation = false;
+// The physics always advances by the same fixed time step, so a given sequence of inputs always plays out the same
+// way no matter how late the simulation thread gets to run
+const step_t d_t = SIM_STEP_US / 1000000.0;
 
-// Performance measuring
-float simulationPeriod = 0;
-uint16_t sampleSize = 1000;
-uint16_t sampleSizeCounter = 0;
+Timer timer;
 
-// boolean values to represent button controlled states
-bool running = false;
-bool paused = false;
-bool practiceMode = true;
+GameState game;
+const GameRules defaultRules = { BEGIN_VELOCITY, BOUNCE_SPEEDUP, AI_DIFFICULTY };
 
-// Used for finding a change in time between screens
-float d_t = 0.0;
-float prev_time = 0.0;
-float current_time = 0.0;
+// Input source of the device game: the input interrupts and the simulation thread's Timer
+bool deviceNextEvent(void *context, InputEvent &event){ return input_next_event(event); }
+uint16_t deviceSlider(void *context, uint8_t slider){ return input_slider(slider); }
+uint32_t deviceClock(void *context){ return timer.read_us(); }
 
-Timer timer;
+#if REPLAY_ENABLED
+Replay deviceReplay;
+#endif
 
-// Initialize shared variables
-Ball *ball;
-Paddle *leftPaddle, *rightPaddle;
-Mutex mtx;
-uint16_t display_score = 0;
-bool showPongText = false;
+std::atomic<uint32_t> snapshotSequence(0);
+std::atomic<uint32_t> snapshotWords[sizeof(GameSnapshot) / sizeof(uint32_t)];
 
-// Score variables
-uint8_t score_left = 0, score_right = 0;
+// Paddles of the last published snapshot and the slider sample time it carries
+uint8_t publishedRows[INPUT_SLIDERS];
+uint32_t publishedInputUs = 0;
 
 int mapValue_i(float x, float in_min, float in_max, int out_min, int out_max) { return static_cast<int>((x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min + 0.5); }
 
@@ -48,21 +49,31 @@ float mapValue_f(float x, float in_min, float in_max, float out_min, float out_m
 
 float vectorMagnitude(float x, float y) { return sqrt(pow(x, 2) + pow(y, 2)); }
 
-void updatePaddlePositions(){
+int mapValue_i(Fix16 x, Fix16 in_min, Fix16 in_max, int out_min, int out_max) { return realToInt((x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min + 0.5); }
+
+Fix16 mapValue_f(Fix16 x, Fix16 in_min, Fix16 in_max, Fix16 out_min, Fix16 out_max) { return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min; }
+
+// x and y are squared as a Q32.32 sum, so the magnitude only costs one integer square root
+Fix16 vectorMagnitude(Fix16 x, Fix16 y) { return fix16_sqrt_q32(static_cast<uint64_t>(static_cast<int64_t>(x.raw) * x.raw) + static_cast<int64_t>(y.raw) * y.raw); }
+
+uint8_t readPaddleSlider(GameState &game, uint8_t slider){ return sliderRow(game.io.slider(game.io.context, slider)); }
 
-    ScopedLock<Mutex> lock(mtx); // Lock mutex in this scope
+void updatePaddlePositions(GameState &game){
+
+    Ball *ball = &game.ball;
+    Paddle *leftPaddle = &game.leftPaddle, *rightPaddle = &game.rightPaddle;
 
     // Update the stored previous location
     leftPaddle->y_prev = leftPaddle->y_idx;
     rightPaddle->y_prev = rightPaddle->y_idx;
 
-    if(!running){
+    if(!game.running){
 
-    int leftPaddle_idx = ball->y_pos - (PADDLE_HEIGHT/2.0); // Find the y_loc desired to set the midpoint of the paddle horizontal to the ball
+    int leftPaddle_idx = realToInt(ball->y_pos - (PADDLE_HEIGHT/2.0)); // Find the y_loc desired to set the midpoint of the paddle horizontal to the ball
     // Bound the paddle_idx between [0, HEIGHT_PX - PADDLE_HEIGHT]
     leftPaddle->y_idx = leftPaddle_idx < 0 ? 0 : (leftPaddle_idx > (HEIGHT_PX - PADDLE_HEIGHT) ? (HEIGHT_PX - PADDLE_HEIGHT) : leftPaddle_idx);
 
-    int rightPaddle_idx = ball->y_pos - (PADDLE_HEIGHT/2.0); // Find the y_loc desired to set the midpoint of the paddle horizontal to the ball
+    int rightPaddle_idx = realToInt(ball->y_pos - (PADDLE_HEIGHT/2.0)); // Find the y_loc desired to set the midpoint of the paddle horizontal to the ball
     // Bound the paddle_idx between [0, HEIGHT_PX - PADDLE_HEIGHT]
     rightPaddle->y_idx = rightPaddle_idx < 0 ? 0 : (rightPaddle_idx > (HEIGHT_PX - PADDLE_HEIGHT) ? (HEIGHT_PX - PADDLE_HEIGHT) : rightPaddle_idx);
 
@@ -71,219 +82,427 @@ void updatePaddlePositions(){
         // Read the analog voltage from potentiometer and map between the minimum
         // and maximum paddle positions [0, HEIGHT_PX - PADDLE_HEIGHT]. Store the 
         // result to the paddle structs
-        leftPaddle->y_idx = mapValue_i(Left.read(), 0.0, 1.0, 0, HEIGHT_PX - PADDLE_HEIGHT);
+        leftPaddle->y_idx = readPaddleSlider(game, INPUT_LEFT);
 
-        if(!practiceMode) rightPaddle->y_idx = mapValue_i(Right.read(), 0.0, 1.0, 0, HEIGHT_PX - PADDLE_HEIGHT);
-        else { 
-            int paddle_idx = ball->y_pos - (PADDLE_HEIGHT/2.0); // Find the y_loc desired to set the midpoint of the paddle horizontal to the ball
-            // Bound the paddle_idx between [0, HEIGHT_PX - PADDLE_HEIGHT]
-            rightPaddle->y_idx = paddle_idx < 0 ? 0 : (paddle_idx > (HEIGHT_PX - PADDLE_HEIGHT) ? (HEIGHT_PX - PADDLE_HEIGHT) : paddle_idx);
-        }
+        if(!game.practiceMode) rightPaddle->y_idx = readPaddleSlider(game, INPUT_RIGHT);
+        else rightPaddle->y_idx = ai_paddle_row(game, rightPaddle->y_idx); // The computer plays the right side
     }
 }
 
-void incrementSpeed(float inc){
+void incrementSpeed(real_t &x_slope, real_t &y_slope, real_t inc){
     // Calculate a 2d vector of magnitude "inc" and the same direction a the ball,
-    // and then add it to the ball's velocity
-    ScopedLock<Mutex> lock(mtx); // Lock mutex while accessing ball shared variable
-    ball->x_slope += inc*(ball->x_slope/vectorMagnitude(ball->x_slope, ball->y_slope));
-    ball->y_slope += inc*(ball->y_slope/vectorMagnitude(ball->x_slope, ball->y_slope));
+    // and then add it to the ball's velocity. The speed stops growing at MAX_VELOCITY
+    real_t v = vectorMagnitude(x_slope, y_slope);
+    if(v + inc > MAX_VELOCITY) inc = v < MAX_VELOCITY ? real_t(MAX_VELOCITY) - v : real_t(0);
+    x_slope += inc*(x_slope/vectorMagnitude(x_slope, y_slope));
+    y_slope += inc*(y_slope/vectorMagnitude(x_slope, y_slope));
 }
 
-float findBallIntercept(float x){
+void reset_point(GameState &game, uint16_t waitFor){
 
-    ScopedLock<Mutex> lock(mtx); // Lock mutex in this scope
+    // Flash the score on the screen 3 times before serving. The flashes are on the point timeline, which
+    // simulation_tick() advances, so input is still read and the step cadence stays the same while they play
+    game.pointShowUs = 5*waitFor/15 * 1000ul;
+    game.pointFlashUs = game.pointShowUs + waitFor/15 * 1000ul;
+    game.pointTimelineUs = 0;
 
-    // Use y=mx+b to find the y intercept location
-    float b = ball->y_pos - (ball->y_slope/ball->x_slope) * ball->x_pos;
-    return (ball->y_slope/ball->x_slope)*x + b + 0.5; // Find y at x = 1 using y = mx + b form
+    if(game.pointFlashUs == 0) serve_point(game);
+    else {
+        game.pointResetting = true;
+        game.display_score = (game.score_left << 8) | (game.score_right); // Show the scores
+    }
 }
 
-void reset_point(uint16_t waitFor){
-
-    // Stop the timer so there isn't a massive d_t meaured after sleeping
-    timer.stop();
-
-    // Flash the score on the screen 3 times
-    for(uint8_t i = 0; i < 3; i++){
-        mtx.lock();
-        display_score = (score_left << 8) | (score_right); // Show the scores
-        mtx.unlock();
-        // Wait before resetting
-        thread_sleep_for(5*waitFor/15); 
-        mtx.lock();
-        display_score = 0;
-        mtx.unlock();
-        // Wait before resetting
-        thread_sleep_for(waitFor/15); 
-    }
+void advancePointTimeline(GameState &game){
+
+    game.pointTimelineUs += SIM_STEP_US;
+    if(game.pointTimelineUs >= 3 * game.pointFlashUs) { serve_point(game); return; }
 
-    
+    // Each flash shows the scores and then blanks them
+    game.display_score = game.pointTimelineUs % game.pointFlashUs < game.pointShowUs ? (game.score_left << 8) | (game.score_right) : 0;
+}
+
+uint32_t gameRandom(GameState &game){
+    game.random ^= game.random << 13;
+    game.random ^= game.random >> 17;
+    game.random ^= game.random << 5;
+    return game.random;
+}
 
-    ScopedLock<Mutex> lock(mtx); // Lock mutex in this scope
+void serve_point(GameState &game){
+
+    Ball *ball = &game.ball;
+
+    game.pointResetting = false;
+    game.display_score = 0;
+    game.ballEvents++;
 
     // Reset ball color to white
     ball->color = COLOR_WHITE;
 
     // Place ball in center position
-    ball->y_pos = static_cast<float>(HEIGHT_PX) / 2;
-    ball->x_pos = static_cast<float>(WIDTH_PX) / 2;
+    ball->y_pos = real_t(HEIGHT_PX) / 2;
+    ball->x_pos = real_t(WIDTH_PX) / 2;
 
     // Set new discrete coordinates for the ball 
-	ball->x_int = (uint8_t)(ball->x_pos + 0.5);
-	ball->y_int = (uint8_t)(ball->y_pos + 0.5);
+	ball->x_int = (uint8_t)realToInt(ball->x_pos + 0.5);
+	ball->y_int = (uint8_t)realToInt(ball->y_pos + 0.5);
+
+    // Random ball direction between -45 and 45 degrees, and a 50% chance for either side
+    uint8_t angle = gameRandom(game) % 255;
+    bool left = gameRandom(game) % 2 == 0;
+    serveSlopes(angle, left, game.rules.beginVelocity, ball->x_slope, ball->y_slope);
 
+    // Read intial state of the sliders after reset
+    game.leftPaddle.y_idx = game.leftPaddle.y_prev = readPaddleSlider(game, INPUT_LEFT);
+    game.rightPaddle.y_idx = game.rightPaddle.y_prev = readPaddleSlider(game, INPUT_RIGHT);
+}
+
+void serveSlopes(uint8_t angle, bool left, real_t speed, real_t &x_slope, real_t &y_slope){
+
+#if PONG_FIXED_POINT
+    // y_slope between -0.5 and 0.5 times the speed, then the matching x_slope from the unit circle table
+    Fix16 ratio = Fix16::fromRaw(angle * 65536 / 254 - 32768);
+    y_slope = ratio * speed;
+    x_slope = unitCircleX(ratio) * speed;
+#else
     // Trying to generate random ball direction between -45 and 45 degrees
-    ball->y_slope = mapValue_f(rand()%255, 0, 254, -0.5*BEGIN_VELOCITY, 0.5*BEGIN_VELOCITY);
+    y_slope = mapValue_f(angle, 0, 254, -0.5*speed, 0.5*speed);
 
     // Calculate a corresponding x_slope
-    ball->x_slope = sqrt(pow(BEGIN_VELOCITY, 2) - pow(ball->y_slope, 2));
-
-    // Flip the x direction with a 50% chance for random starting direction
-    if(rand() % 2 == 0) ball->x_slope = -ball->x_slope;
+    x_slope = sqrt(pow(speed, 2) - pow(y_slope, 2));
+#endif
 
-    // Read intial state of the sliders after reset
-    leftPaddle->y_idx = leftPaddle->y_prev = mapValue_i(Left.read(), 0.0, 1.0, 0, HEIGHT_PX - PADDLE_HEIGHT);
-    rightPaddle->y_idx = rightPaddle->y_prev = mapValue_i(Right.read(), 0.0, 1.0, 0, HEIGHT_PX - PADDLE_HEIGHT);
+    if(left) x_slope = -x_slope;
+}
 
-    // Resume the timer 
-    timer.start();
+void bounceOffPaddle(real_t &x_slope, real_t &y_slope, real_t y, uint8_t paddleRow, int8_t direction, real_t speedup){
+
+    // Recaulculate the ball direction based on intercept location
+    real_t v = vectorMagnitude(x_slope, y_slope);
+#if PONG_FIXED_POINT
+    // Same mapping as the float path: the y_slope / v ratio goes linearly from -pi/4 to pi/4 along the paddle, and
+    // the x_slope / v ratio comes from the unit circle table instead of sqrt(v^2 - y_slope^2)
+    Fix16 along = ((mapValue_f(y, 0, HEIGHT_PX, 0, HEIGHT_PX - 1) - paddleRow) + 1) / (PADDLE_HEIGHT + 1);
+    along = along < 0 ? Fix16(0) : (along > 1 ? Fix16(1) : along);
+    Fix16 ratio = (along * 2 - 1) * (M_PI / 4);
+    y_slope = v * ratio;
+    x_slope = v * unitCircleX(ratio) * direction;
+#else
+    float k = v * M_PI / 4; // |v| * sin(45) // Max and min y_slope value
+    y_slope = ((mapValue_f(y, 0, HEIGHT_PX, 0, HEIGHT_PX - 1) - paddleRow) + 1) / (PADDLE_HEIGHT + 1.0) * 2 * k - k;
+    // A hit just past the end of the paddle would give |y_slope| > v and a NaN x_slope, so treat it as the paddle end
+    y_slope = y_slope < -k ? -k : (y_slope > k ? k : y_slope);
+    x_slope = direction * sqrt(pow(v, 2) - pow(y_slope, 2));
+#endif
+
+    // Increase speed after changing direction
+    incrementSpeed(x_slope, y_slope, speedup);
 }
 
-void updateBallState(){
-	
-    //ScopedLock<Mutex> lock(mtx); // Lock mutex in this scope
-    mtx.lock();
-
-	// Move ball by the distance calculated from time step d_t and velocity vector
-	ball->x_pos += d_t * ball->x_slope;
-	ball->y_pos += d_t * ball->y_slope;
-
-    // Collision detection for the top and bottom walls in the simulation
-    if (ball->y_pos >= HEIGHT_PX) { // Top out of bounds collision
-        ball->y_pos = 2*HEIGHT_PX - ball->y_pos;
-        ball->y_slope *= -1;
-    } else if (ball->y_pos <= 0) { // Bottom out of bounds collision
-        ball->y_pos = abs(ball->y_pos);
-        ball->y_slope *= -1;
-    }
+SweepResult sweepBall(real_t &x_pos, real_t &y_pos, real_t &x_slope, real_t &y_slope, uint8_t leftRow, uint8_t rightRow,
+                      real_t speedup){
+
+    step_t remaining = d_t; // Part of this step the ball still has to travel
+    SweepResult result = SWEEP_FREE;
+
+    // Swept collision handling: instead of moving the full step and then checking where the ball ended up, find the
+    // first wall or paddle plane the ball's path crosses, move it exactly there, resolve the contact and carry on with
+    // the rest of the step. A fast ball can then never skip past a boundary, and the number of contacts handled per
+    // step is bounded so the cost of a step is too
+    for(uint8_t contact = 0; contact <= SIM_MAX_CONTACTS; contact++){
 
-	// Check the coordinates and readjust them to stay within bounds
-    if (ball->x_pos >= WIDTH_PX - 1) { // Right out of bounds
-        
-        float y = findBallIntercept(WIDTH_PX - 1); // Get the y intercept of the ball's path and paddle
-        uint8_t y_idx = mapValue_i(y, 0, HEIGHT_PX, 0, HEIGHT_PX - 1); // Map the simulation coordinates to matrix indexes
-
-        // Check if paddle is there or not. The ball will either bounce or the point will end.
-        if(y_idx <= (rightPaddle->y_idx + PADDLE_HEIGHT - 1) & y_idx >= rightPaddle->y_idx){ // Paddle is there
-            ball->x_pos = 2*WIDTH_PX - ball->x_pos - 2; // Move ball inounds
-
-            // Recaulculate the ball direction based on intercept location
-            float v = vectorMagnitude(ball->x_slope, ball->y_slope);
-            float k = v * M_PI / 4; // |v| * sin(45) // Max and min y_slope value
-            ball->y_slope = ((mapValue_f(y, 0, HEIGHT_PX, 0, HEIGHT_PX - 1) - rightPaddle->y_idx) + 1) / (PADDLE_HEIGHT + 1.0) * 2 * k - k;
-            ball->x_slope = -sqrt(pow(v, 2) - pow(ball->y_slope, 2));
-
-            // Increase speed by 2 after changing direction
-            incrementSpeed(2);
-        } else { // Paddle isn't there
-            ball->x_pos = WIDTH_PX - 0.5; // Set location to intercept and velocity to 0. change color to red
-            ball->y_pos = y;
-            ball->x_slope = ball->y_slope = 0;
-            ball->color = COLOR_RED;
-            score_left++;
+        real_t x = x_pos + remaining * x_slope;
+        real_t y = y_pos + remaining * y_slope;
+
+        bool crossesWall = (y_slope > 0 & y > HEIGHT_PX) | (y_slope < 0 & y < 0);
+        bool crossesPaddle = (x_slope > 0 & x > WIDTH_PX - 1) | (x_slope < 0 & x < 1);
+
+        // Nearly every step ends here: nothing in the way, so just move the ball
+        if((!crossesWall & !crossesPaddle) | contact == SIM_MAX_CONTACTS){
+            x_pos = x;
+            y_pos = y;
+            break;
         }
-    } else if (ball->x_pos <= 1) { // Left out of bounds
-
-        float y = findBallIntercept(1); // Get the y intercept of the ball's path and paddle
-        uint8_t y_idx = mapValue_i(y, 0, HEIGHT_PX, 0, HEIGHT_PX - 1); // Map the simulation coordinates to matrix indexes
-
-        // Check if paddle is there
-        if(y_idx <= (leftPaddle->y_idx + PADDLE_HEIGHT - 1) & y_idx >= leftPaddle->y_idx){ // Paddle is there
-            ball->x_pos = 2 - ball->x_pos; // Move ball inbounds
-
-            // Recaulculate the ball direction based on intercept location
-            float v = vectorMagnitude(ball->x_slope, ball->y_slope);
-            float k = v * M_PI / 4; // |v| * sin(45)
-            ball->y_slope = ((mapValue_f(y, 0, HEIGHT_PX, 0, HEIGHT_PX - 1) - leftPaddle->y_idx) + 1) / (PADDLE_HEIGHT + 1.0) * 2 * k - k;
-            ball->x_slope = sqrt(pow(v, 2) - pow(ball->y_slope, 2));
-
-            // Increase speed by 2 after changing direction
-            incrementSpeed(2);
-        } else { // Paddle isn't there
-            ball->x_pos = 0.5; 
-            ball->y_pos = y;
-            ball->x_slope = ball->y_slope = 0;
-            ball->color = COLOR_RED;
-            score_right++;
+
+        // Time until the ball reaches each boundary it crosses during this step
+        real_t wallTime = remaining, paddleTime = remaining;
+        if(crossesWall) wallTime = ((y_slope > 0 ? HEIGHT_PX : 0) - y_pos) / y_slope;
+        if(crossesPaddle) paddleTime = ((x_slope > 0 ? WIDTH_PX - 1 : 1) - x_pos) / x_slope;
+        if(wallTime < 0) wallTime = 0;
+        if(paddleTime < 0) paddleTime = 0;
+
+        if(crossesWall & (!crossesPaddle | wallTime < paddleTime)){ // Top or bottom wall comes first: bounce off it
+
+            x_pos += wallTime * x_slope;
+            y_pos = y_slope > 0 ? HEIGHT_PX : 0;
+            y_slope = -y_slope;
+            remaining -= wallTime;
+
+        } else { // The ball reaches the column of a paddle first
+
+            y_pos += paddleTime * y_slope;
+            remaining -= paddleTime;
+
+            bool right = x_slope > 0;
+            uint8_t paddleRow = right ? rightRow : leftRow;
+            // The intercept has always been taken at y + 0.5, the middle of the pixel row, so the paddle test and the
+            // bounce angle keep that offset and every zone of the paddle stays where it was
+            real_t hitY = y_pos + real_t(0.5);
+            uint8_t y_idx = mapValue_i(hitY, 0, HEIGHT_PX, 0, HEIGHT_PX - 1); // Map the simulation coordinates to matrix indexes
+
+            // Check if paddle is there or not. The ball will either bounce or the point will end.
+            if(y_idx <= (paddleRow + PADDLE_HEIGHT - 1) & y_idx >= paddleRow){ // Paddle is there
+                x_pos = right ? WIDTH_PX - 1 : 1;
+                bounceOffPaddle(x_slope, y_slope, hitY, paddleRow, right ? -1 : 1, speedup);
+                result = SWEEP_BOUNCED;
+            } else {
+                return SWEEP_MISSED;
+            }
         }
     }
+    return result;
+}
+
+void updateBallState(GameState &game){
+
+    Ball *ball = &game.ball;
+    SweepResult result = sweepBall(ball->x_pos, ball->y_pos, ball->x_slope, ball->y_slope, game.leftPaddle.y_idx,
+                                   game.rightPaddle.y_idx, game.rules.bounceSpeedup);
+    if(result != SWEEP_FREE) game.ballEvents++;
+
+    if(result == SWEEP_MISSED){ // Paddle isn't there. Set location to intercept and velocity to 0. change color to red
+        bool right = ball->x_slope > 0;
+        ball->x_pos = right ? WIDTH_PX - 0.5 : 0.5;
+        ball->x_slope = ball->y_slope = 0;
+        ball->color = COLOR_RED;
+        if(right) game.score_left++;
+        else game.score_right++;
+        reset_point(game, 5000); // Serve again after the score has been shown
+    }
 
 	// Set new discrete coordinates for the ball 
     ball->x_int = mapValue_i(ball->x_pos, 0, WIDTH_PX, 0, WIDTH_PX - 1);
     ball->y_int = mapValue_i(ball->y_pos, 0, HEIGHT_PX, 0, HEIGHT_PX - 1);
+}
+
+void simulation_tick(GameState &game){
+
+    game.showPongText = !game.running;
+
+    checkButtons(game);
+
+    if(!game.paused) { // Don't step the simulator if the game is paused
+
+        // Update the location of the paddles
+        updatePaddlePositions(game);
+
+        // The ball waits where it went out while the point timeline plays
+        if(game.pointResetting) advancePointTimeline(game);
+        else {
+            // Update the ball velocity, direction, position, and color
+            TRACE_START(physicsStart);
+            updateBallState(game);
+            TRACE_CYCLES(TRACE_PHYSICS, physicsStart);
+        }
+
+#if MULTIBALL_ENABLED
+        // The extra balls keep going through the point timeline
+        multiball_tick(game);
+#endif
+    }
 
-    // Reset the point if the ball has a slope vector of 0. Unlock mutex before resetting, but after accessing ball in conditional.
-    if(ball->x_slope == 0 & ball->y_slope == 0) {
-        mtx.unlock();
-        reset_point(5000);
-    } else { mtx.unlock(); }
+    game.simulationTicks++;
 }
 
-void simulation_step(){
+void simulation_step(GameState &game){
+
+    TRACE_START(stepStart);
+    game.simulationWakeups++;
 	
-	// Evaluate d_t from current time and previous time
-    current_time = timer.read();
-    d_t = current_time - prev_time;
-    prev_time = current_time;
-
-    simulationPeriod += d_t;
-    sampleSizeCounter++;
-    if (sampleSizeCounter >= sampleSize) { 
-        simulationPeriod /= sampleSizeCounter;
-        if(measurePerformance_simulation) { printf("\n\rAverage simulation time step period over %i samples: %f ms", sampleSize, simulationPeriod); }
-        sampleSizeCounter = simulationPeriod = 0;
+	// Evaluate the time since the previous step
+    uint32_t current_time = game.io.clockUs(game.io.context);
+    uint32_t elapsed = current_time - game.prevTime;
+    game.prevTime = current_time;
+
+    // Run as many fixed ticks as the elapsed time covers. After a long stall only SIM_MAX_CATCHUP ticks are run and
+    // the rest of the time is dropped, so one step never does an unbounded amount of work
+    game.stepAccumulator += elapsed;
+    if(game.stepAccumulator > SIM_MAX_CATCHUP * SIM_STEP_US){
+        game.droppedTicks += game.stepAccumulator / SIM_STEP_US - SIM_MAX_CATCHUP;
+        game.stepAccumulator = SIM_MAX_CATCHUP * SIM_STEP_US + game.stepAccumulator % SIM_STEP_US;
+    }
+    while(game.stepAccumulator >= SIM_STEP_US){
+        game.stepAccumulator -= SIM_STEP_US;
+        simulation_tick(game);
     }
 
-    mtx.lock();
-    showPongText = !running;
-    mtx.unlock();
+    TRACE_CYCLES(TRACE_STEP_TIME, stepStart);
+}
 
-    checkButtons();
+// Lowers ticks to the number of ticks it takes pos, moving at slope, to reach boundary, if that is sooner
+void earliestTick(uint32_t &ticks, real_t pos, real_t slope, real_t boundary){
 
-    if(paused) return; // Don't step the simulator if the game is paused
+    real_t distance = boundary - pos;
+    real_t perTick = slope * d_t; // How far pos moves in a tick
+    real_t reach = perTick * static_cast<int>(ticks); // How far pos moves in the current number of ticks
 
-    // Update the location of the paddles
-    updatePaddlePositions();
+    // Moving away from the boundary, or not getting to it in time. Checking this first also keeps the division below
+    // in range for the fixed point physics
+    if(perTick > 0 ? (distance < 0 | distance > reach) : (perTick == 0 | distance > 0 | distance < reach)) return;
 
-    // Update the ball velocity, direction, position, and color
-    updateBallState();
+    // The tick the boundary is crossed in, so that it has been simulated when the thread wakes up
+    uint32_t crossing = realToInt(distance / perTick) + 1;
+    if(crossing < ticks) ticks = crossing;
 }
 
-void checkButtons(){
+uint32_t simulation_sleep_ms(const GameState &game){
+
+    const Ball *ball = &game.ball;
+    uint32_t ticks = SIM_INPUT_SAMPLE_MS * 1000 / SIM_STEP_US;
+
+#if MULTIBALL_ENABLED
+    // Some extra ball moves to another pixel nearly every tick, so there is nothing to sleep through
+    if(!game.paused & balls.count > 0) return 1;
+#endif
+
+    if(!game.paused & game.pointResetting){ // The ball waits for the serve, so the next event is the score flashing on or off
+        uint32_t position = game.pointTimelineUs % game.pointFlashUs;
+        uint32_t change = (position < game.pointShowUs ? game.pointShowUs : game.pointFlashUs) - position;
+        if((change + SIM_STEP_US - 1) / SIM_STEP_US < ticks) ticks = (change + SIM_STEP_US - 1) / SIM_STEP_US;
+    } else if(!game.paused){ // The ball stays put while paused, so only the buttons need to be sampled
+
+        // Top and bottom walls, and the columns the paddles are in
+        earliestTick(ticks, ball->y_pos, ball->y_slope, ball->y_slope > 0 ? HEIGHT_PX : 0);
+        earliestTick(ticks, ball->x_pos, ball->x_slope, ball->x_slope > 0 ? WIDTH_PX - 1 : 1);
+
+        // Edges of the pixel the ball is drawn at, the inverse of the mapValue_i() in updateBallState()
+        real_t edge = ball->x_slope > 0 ? 0.5 : -0.5;
+        earliestTick(ticks, ball->x_pos, ball->x_slope, (real_t(ball->x_int) + edge) * WIDTH_PX / (WIDTH_PX - 1));
+        edge = ball->y_slope > 0 ? 0.5 : -0.5;
+        earliestTick(ticks, ball->y_pos, ball->y_slope, (real_t(ball->y_int) + edge) * HEIGHT_PX / (HEIGHT_PX - 1));
+
+        // The paddles on the title screen follow the ball, so they move every time the ball crosses a whole row
+        if(!game.running){
+            int row = realToInt(ball->y_pos);
+            earliestTick(ticks, ball->y_pos, ball->y_slope, ball->y_slope > 0 ? row + 1 : row);
+        }
+    }
 
-    if(!Reset.read()){ // Reset button
-        reset_point(0);
-        paused = false;
-        running = false;
-        practiceMode = true;
-        thread_sleep_for(200);
+    // The computer's paddle moves on its own schedule, also while the scores flash
+    if(!game.paused & game.running & game.practiceMode){
+        uint32_t move = ai_ticks_until_move(game);
+        if(move < ticks) ticks = move;
     }
 
-    if(!Pause.read()) { 
-        running ? paused = !paused : running = true; 
-        timer.stop();
-        thread_sleep_for(200);
-        timer.start();
-    } // Pause/Play the game, or start the game if not running
-
-    if(!PlayerChange.read() & running) { 
-        practiceMode = !practiceMode; 
-        thread_sleep_for(200);
-    } // Player change button
+    uint32_t ms = ticks * SIM_STEP_US / 1000;
+    return ms ? ms : 1;
 }
 
-void simulate(){
+void publishSnapshot(const GameState &game){
+
+    GameSnapshot snapshot;
+    snapshot.leftPaddleRow = game.leftPaddle.y_idx;
+    snapshot.rightPaddleRow = game.rightPaddle.y_idx;
+    snapshot.displayScore = game.display_score;
+    snapshot.ballColor = game.ball.color;
+    snapshot.ball_x = game.ball.x_int;
+    snapshot.ball_y = game.ball.y_int;
+    snapshot.showText = game.showPongText;
+#if MULTIBALL_ENABLED
+    multiball_publish(snapshot);
+#endif
+
+    // A paddle its slider moved carries the time of the sample that moved it. When both moved, the earlier one is
+    // kept, the display can't show one before the other. A replay's paddles don't follow the sliders
+#if !REPLAY_ENABLED
+    if(game.running){
+        bool moved[INPUT_SLIDERS] = { snapshot.leftPaddleRow != publishedRows[INPUT_LEFT],
+                                      !game.practiceMode && snapshot.rightPaddleRow != publishedRows[INPUT_RIGHT] };
+        uint32_t now = us_ticker_read();
+        uint32_t oldest = 0;
+        for(uint8_t s = 0; s < INPUT_SLIDERS; s++){
+            uint32_t sample = input_slider_moved_us(s);
+            if(moved[s] && (oldest == 0 || now - sample > now - oldest)) oldest = sample;
+        }
+        if(oldest != 0) publishedInputUs = oldest;
+    }
+#endif
+    publishedRows[INPUT_LEFT] = snapshot.leftPaddleRow;
+    publishedRows[INPUT_RIGHT] = snapshot.rightPaddleRow;
+    snapshot.inputUs = publishedInputUs;
+
+    uint32_t words[sizeof(GameSnapshot) / sizeof(uint32_t)];
+    memcpy(words, &snapshot, sizeof(GameSnapshot));
+
+    // Only this thread writes, so the sequence can be bumped with a plain load and store. The Cortex-M0+ has no
+    // exclusive access instructions, so this keeps every access a single ldr/str
+    uint32_t sequence = snapshotSequence.load(std::memory_order_relaxed);
+    snapshotSequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for(uint8_t i = 0; i < sizeof(words) / sizeof(uint32_t); i++){ snapshotWords[i].store(words[i], std::memory_order_relaxed); }
+    snapshotSequence.store(sequence + 2, std::memory_order_release);
+}
+
+bool readSnapshot(GameSnapshot &snapshot){
+
+    uint32_t sequence = snapshotSequence.load(std::memory_order_acquire);
+    if(sequence == 0 | sequence & 1) return false; // Nothing published yet, or a snapshot is being written right now
+
+    uint32_t words[sizeof(GameSnapshot) / sizeof(uint32_t)];
+    for(uint8_t i = 0; i < sizeof(words) / sizeof(uint32_t); i++){ words[i] = snapshotWords[i].load(std::memory_order_relaxed); }
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    // The writer got in while the words were being copied
+    if(snapshotSequence.load(std::memory_order_relaxed) != sequence) return false;
+
+    memcpy(&snapshot, words, sizeof(GameSnapshot));
+    return true;
+}
+
+void checkButtons(GameState &game){
+
+    // The presses were debounced when they happened, so nothing here has to wait
+    InputEvent event;
+    while(game.io.nextEvent(game.io.context, event)){
+        switch(event.button){
+            case INPUT_RESET: // Reset button
+                reset_point(game, 0);
+                game.paused = false;
+                game.running = false;
+                game.practiceMode = true;
+                break;
+            case INPUT_PAUSE: // Pause/Play the game, or start the game if not running
+                game.running ? game.paused = !game.paused : game.running = true;
+                break;
+            case INPUT_PLAYER: // Player change button
+                if(game.running) game.practiceMode = !game.practiceMode;
+                break;
+        }
+    }
+}
+
+void game_init(GameState &game, const GameIO &io, const GameRules &rules, uint32_t seed){
+
+    game = GameState();
+    game.io = io;
+    game.rules = rules;
+    game.practiceMode = true;
+
+    // Xorshift never leaves 0, so mix the seed into a nonzero constant
+    game.random = seed ^ 2463534242u;
+    if(game.random == 0) game.random = 2463534242u;
+
+    ai_init(game);
+
+    // Time is measured from here
+    game.prevTime = io.clockUs(io.context);
+
+    // Perform a point reset with a delay of 0
+    reset_point(game, 0);
+}
+
+void simulation_init(){
 
     // Seed the random number generator
     int rnd_seed = 0;
@@ -291,30 +510,51 @@ void simulate(){
         int bit = mapValue_i(seed.read(), 0.0, 1.0, 0, 255);
         rnd_seed = (rnd_seed | ((1 << i) & bit));
     }
-    srand(rnd_seed);
 
-    mtx.lock(); // Lock Mutex while accessing ball struct
-
-    // Allocate the ball struct
-    ball = (Ball*) malloc(sizeof(Ball));
-    // Allocate Paddles
-    leftPaddle = (Paddle*) malloc(sizeof(Paddle));
-    rightPaddle = (Paddle*) malloc(sizeof(Paddle));
-	
-    mtx.unlock();
+    // Start sampling the sliders and listening to the buttons
+    input_init();
 
     // Begin the timer for time tracking
 	timer.start();
-    
-    // Perform a point reset with a delay of 0
-    reset_point(0);
+
+    GameIO io = { deviceNextEvent, deviceSlider, deviceClock, nullptr };
+#if REPLAY_ENABLED
+    // The buttons and sliders do nothing while the recording plays. A recording from a different build can't be
+    // replayed, so then the game is played as usual
+    if(!replay_start(deviceReplay, game, replayDump, sizeof(replayDump), io)) game_init(game, io, defaultRules, rnd_seed);
+#elif RECORD_ENABLED
+    record_start(game, io, defaultRules, rnd_seed);
+#else
+    game_init(game, io, defaultRules, rnd_seed);
+#endif
+
+#if MULTIBALL_ENABLED
+    multiballRamping = true;
+    multiball_init(game, MULTIBALL_START);
+#endif
+}
+
+void simulate(){
 
 	// Main loop of this thread: 
 	for(;;){
 
-		simulation_step();
+		simulation_step(game);
+
+		// Hand the result of this step to the display thread
+		publishSnapshot(game);
 		
-		// Wait a millisecond between simulation steps
-		thread_sleep_for(1);
+		// Wait a millisecond between simulation steps, or until the next event
+		uint32_t sleep_ms = eventDrivenSimulation ? simulation_sleep_ms(game) : 1;
+#if TRACE_ENABLED
+		uint32_t wake_us = us_ticker_read() + sleep_ms * 1000;
+#endif
+		thread_sleep_for(sleep_ms);
+
+#if TRACE_ENABLED
+		// How much later than asked the RTOS got back to this thread
+		int32_t latency = us_ticker_read() - wake_us;
+		TRACE_VALUE(TRACE_WAKEUP_LATENCY, latency > 0 ? latency : 0);
+#endif
 	}
 }
@@ -4,6 +4,11 @@
  */
  
 #include "pong.h"
+#include "bcm_matrix.h"
+#include "executive.h"
+#include "multiball.h"
+#include "sprites.h"
+#include "trace.h"
  
 // Set the inputs and outputs for the rgb_matrix header pins
 DigitalOut R1(PTC13);
@@ -22,125 +27,580 @@ DigitalOut CLK(PTC2);
 DigitalOut LAT(PTC0);
  
 // GPIO port C instance
+#ifdef PONG_HOST
+volatile GPIO_TypeDef *GPIOC = &host_gpioc;
+#else
 volatile GPIO_TypeDef *GPIOC = reinterpret_cast<GPIO_TypeDef*>(GPIOC_BASE);
+#endif
 
-bool measurePerformance = false;
+RowMask titleMask[HEIGHT_PX];
 
-uint16_t pongTextMatrix[5] = { 0x8EAF, 0x8AA9, 0xEEEB, 0xA008, 0xE00F  };
-uint8_t text_origin[2] = { WIDTH_PX/2 - 8 - 1, HEIGHT_PX/2 - 3 };
+// Counters for the trace dump
+uint32_t matrixFrames = 0;
+uint32_t staleSnapshots = 0;
+
+RenderStats renderStats;
+
+uint32_t frameStart_us = 0; // When the previous frame started, for the frame period
+
+ScanSchedule scanSchedule;
+ScanStats scanStats;
+
+// Refresh rate and brightness asked for by rgb_matrix_set_scan(), packed as refreshHz << 8 | brightness so that the
+// scan reads them in one go. The scan switches over when it differs from the request it applied last
+std::atomic<uint32_t> scanRequest(SCAN_REFRESH_HZ << 8 | SCAN_BRIGHTNESS);
+uint32_t scanApplied = 0;
+
+// When the lit row was lit, for scanStats
+uint32_t scanLitStart = 0;
+bool scanLit = false;
+
+// Longest time shifting a row in took in the scan thread loop, in microseconds
+uint32_t scanShiftTime = 0;
+
+ScanSchedule makeSchedule(uint16_t refreshHz, uint8_t brightness){
+
+    ScanSchedule schedule;
+    if(refreshHz < SCAN_MIN_REFRESH_HZ) refreshHz = SCAN_MIN_REFRESH_HZ;
+    if(refreshHz > SCAN_MAX_REFRESH_HZ) refreshHz = SCAN_MAX_REFRESH_HZ;
+    schedule.refreshHz = refreshHz;
+    schedule.rowUs = 1000000 / (refreshHz * SCAN_ROWS);
+#if BCM_ENABLED
+    // The planes of a row at full weight take BCM_ROW_US, which has to fit in the row slot
+    uint32_t brightest = schedule.rowUs * UINT8_MAX / BCM_ROW_US;
+    if(brightness > brightest) brightness = brightest;
+    schedule.litUs = (BCM_ROW_US * brightness + UINT8_MAX / 2) / UINT8_MAX;
+#else
+    schedule.litUs = (schedule.rowUs * brightness + UINT8_MAX / 2) / UINT8_MAX;
+#endif
+    schedule.brightness = brightness;
+    return schedule;
+}
+
+// Switches to the requested schedule if it changed. Called by the scan at the start of a frame. Returns true if the
+// row period changed
+bool applyScanRequest(){
+    uint32_t request = scanRequest.load();
+    if(request == scanApplied) return false;
+    scanApplied = request;
+    uint32_t rowUs = scanSchedule.rowUs;
+    scanSchedule = makeSchedule(request >> 8, request & UINT8_MAX);
+    return scanSchedule.rowUs != rowUs;
+}
+
+ScanSchedule rgb_matrix_set_scan(uint16_t refreshHz, uint8_t brightness){
+    ScanSchedule schedule = makeSchedule(refreshHz, brightness);
+    scanRequest = static_cast<uint32_t>(schedule.refreshHz) << 8 | schedule.brightness;
+    return schedule;
+}
+
+void rgb_matrix_report(){
+
+    static ScanStats reported;
+    static uint32_t reported_us = 0;
+    ScanStats stats = scanStats;
+    uint32_t now_us = us_ticker_read();
+    uint32_t elapsed = now_us - reported_us;
+    uint32_t frames = stats.frames - reported.frames;
+    uint32_t lit = stats.litUs - reported.litUs;
+    reported = stats;
+    reported_us = now_us;
+    if(elapsed == 0) return;
+
+    // Integer arithmetic only, so that it works with minimal printf
+    printf("\n\rScan: target %u Hz at brightness %u (%u of %u us lit per row), achieved %u Hz with rows lit %u.%u%% of the time",
+           scanSchedule.refreshHz, scanSchedule.brightness, (unsigned)scanSchedule.litUs, (unsigned)scanSchedule.rowUs,
+           (unsigned)(frames * 1000000ull / elapsed), (unsigned)(lit * 100ull / elapsed), (unsigned)(lit * 1000ull / elapsed % 10));
+
+    static RenderStats rendered;
+    RenderStats render = renderStats;
+    uint32_t scenes = render.scenes - rendered.scenes;
+    uint32_t rows = render.rows - rendered.rows;
+    rendered = render;
+    if(scenes == 0 || frames == 0) return;
+    printf("\n\rRender: %u scenes, %u.%u of %u rows rebuilt per scene, %u.%u per frame", (unsigned)scenes,
+           (unsigned)(rows / scenes), (unsigned)(rows * 10 / scenes % 10), SCAN_ROWS, (unsigned)(rows / frames),
+           (unsigned)(rows * 10 / frames % 10));
+}
+
+// Lit time bookkeeping for scanStats
+inline void rowLit(uint32_t now_us){
+    scanLitStart = now_us;
+    scanLit = true;
+}
+
+inline void rowBlanked(){
+    if(scanLit){
+        scanStats.litUs += us_ticker_read() - scanLitStart;
+        scanLit = false;
+    }
+}
+
+// Busy waits until the microsecond counter reaches deadline, if it hasn't yet
+inline void waitUntil(uint32_t deadline){
+    int32_t left = static_cast<int32_t>(deadline - us_ticker_read());
+    if(left > 0) { wait_us(left); }
+}
+
+// Waits out a part of a row slot in which nothing on the port has to change. The executive does its work in it
+inline void idleUntil(uint32_t deadline){
+#if EXECUTIVE_ENABLED
+    executive_idle(deadline);
+#endif
+    waitUntil(deadline);
+}
+
+void rgb_matrix_init(){
+
+	// Clear every GPIOC bit being used except for OE'
+    GPIOC->PCOR = PORT_LAT | PORT_CLK | PORT_ROW_MASK | PORT_RGB_MASK;
+
+    // The logo sits just left of the center of the panel
+    memset(titleMask, 0, sizeof(titleMask));
+    blitSprite(titleMask, pongLogo, WIDTH_PX/2 - pongLogo.width/2 - 1, HEIGHT_PX/2 - 3);
+
+    frameStart_us = us_ticker_read();
+    applyScanRequest();
+}
 
 void rgb_matrix_function(){
     
-    // Sleep for 10 milliseconds to ensure that the pong simulation thread has
-    // allocated the ball and paddle structs and everything
-    thread_sleep_for(10);
-	 
-	// Clear 13 GPIOC bits being used except for OE'
-    GPIOC->PCOR = 16381;
-
-    // Counter used for generating rows
-    uint32_t row = 0;
-
-    // Performance measuring
-    float framePeriod = 0;
-    uint16_t sampleSize = 1000;
-    uint16_t sampleSizeCounter = 0;
-    float d_t = 0.0;
-    float prev_time = 0.0;
-    float current_time = 0.0;
-
-    Timer timer;
-    timer.start();
-
-    // Main thread loop. This loops scans over every row. For each row, every column pixel must be calculated.
-    // It is more efficient to check the current locations of the paddles, ball, etc every time they are displayed than 
-    // to store a 2d array of pixel values that must be managed. 
+    rgb_matrix_init();
+
+#if SCAN_INTERRUPT
+    rgb_matrix_start_scan();
+
+    // Main thread loop. The interrupt does the scanning, so this only draws new scenes. The simulation publishes at
+    // most once a millisecond
+    for (;;) {
+        rgb_matrix_render();
+        thread_sleep_for(1);
+    }
+#else
+    // Main thread loop. Every iteration scans over the whole matrix once
     for (;;) {
+        rgb_matrix_frame();
+    }
+#endif
+}
+
+port_word_t frameBuffer[FRAME_BUFFERS][SCAN_ROWS][WIDTH_PX];
+uint8_t frontBuffer = 0;
+std::atomic<uint32_t> bufferSwaps(0);
+
+GameSnapshot renderedScene; // Scene most recently drawn, in the front buffer or waiting to be swapped in
+bool sceneRendered = false; // False until the first scene has been drawn
+
+static_assert(SCAN_ROWS <= 32, "Dirty rows are a 32 bit mask of frame buffer rows");
+#define ALL_SCAN_ROWS (UINT32_MAX >> (32 - SCAN_ROWS))
+
+// Scene each frame buffer was last drawn with, and the frame buffer rows that hold exactly that scene. A new scene is
+// only drawn into the rows it changes and the rows that don't hold their scene. None do before the first draw
+GameSnapshot bufferScene[FRAME_BUFFERS];
+uint32_t bufferValidRows[FRAME_BUFFERS];
+
+// Paddles each frame buffer shows, for the input latency trace and the low latency fast path
+struct BufferPaddles {
+    uint8_t left, right;
+    uint32_t inputUs; // GameSnapshot::inputUs of the scene they are from
+    uint32_t moveRows; // Frame buffer rows they differ in from what was on the panel when they were drawn
+};
+BufferPaddles bufferPaddles[FRAME_BUFFERS];
+
+// Row select lines of the row pair currently latched. They are kept on the port while the next row is shifted in
+uint32_t latchedRowWord = 0;
+
+// Row interrupt state
+Ticker scanTicker;
+Timeout blankTimeout; // Ends the lit time of a row when it is shorter than the row period
+uint8_t scanRow = 0; // Frame buffer row the next interrupt shifts in
+std::atomic<bool> swapPending(false); // Set by rgb_matrix_render() once the back buffer holds a new scene
+#if TRACE_ENABLED
+TraceStart scanLatch; // When the interrupt last latched a row
+bool scanLatchValid = false;
+#endif
+
+// Whether pixel row y is on one of the frame buffer rows set in dirtyRows
+inline bool rowDirty(uint32_t dirtyRows, uint8_t y){
+    return dirtyRows >> (y < SCAN_ROWS ? y : y - SCAN_ROWS) & 1;
+}
+
+// Light every pixel set in a row mask on the dirty rows. Only costs anything for the lit pixels
+void drawMask(port_word_t rows[][WIDTH_PX], const RowMask mask[HEIGHT_PX], uint8_t color, uint32_t dirtyRows){
+    for(uint8_t y = 0; y < HEIGHT_PX; y++){
+        if(!rowDirty(dirtyRows, y)) continue;
+        for(uint8_t w = 0; w < ROW_MASK_WORDS; w++){
+            for(uint64_t bits = mask[y].word[w]; bits; bits &= bits - 1){ setPixel(rows, w * 64 + __builtin_ctzll(bits), y, color); }
+        }
+    }
+}
+
+// Light a pixel of a score bar. The BCM engine shows the bars dimmed, so there they are drawn behind whatever else
+// is already on a pixel instead of mixing with it. The other scans have no dimmed colors and mix them as usual
+inline void setScorePixel(port_word_t rows[][WIDTH_PX], uint8_t x, uint8_t y){
+#if BCM_ENABLED
+    bool top = y < SCAN_ROWS;
+    port_word_t &word = rows[top ? y : y - SCAN_ROWS][x];
+    uint8_t shift = top ? PORT_RGB1_SHIFT : PORT_RGB2_SHIFT;
+    if (word >> shift & 7) return;
+    word |= SCORE_COLOR << shift | (top ? PORT_DIM1 : PORT_DIM2);
+#else
+    setPixel(rows, x, y, SCORE_COLOR);
+#endif
+}
+
+static_assert(HEIGHT_PX <= 64, "Pixel rows are compared as 64 bit masks");
 
-        // Evaluate d_t from current time and previous time. This time change is the period of one frame being displayed
-        current_time = timer.read();
-        d_t = current_time - prev_time;
-        prev_time = current_time;
-
-        framePeriod += d_t;
-        sampleSizeCounter++;
-        if (sampleSizeCounter >= sampleSize) { 
-            framePeriod /= sampleSizeCounter;
-            if(measurePerformance) { printf("\n\rAverage frame period over %i samples: %f ms", sampleSize, framePeriod); }
-            sampleSizeCounter = framePeriod = 0;
+// Folds a mask of pixel rows onto the frame buffer rows they are on
+inline uint32_t scanRowsOf(uint64_t pixelRows){
+    return (pixelRows | pixelRows >> SCAN_ROWS) & ALL_SCAN_ROWS;
+}
+
+// Pixel rows a paddle changes in when it moves from one row to another
+inline uint64_t paddleRowsMoved(uint8_t from, uint8_t to){
+    uint64_t paddle = (1ull << PADDLE_HEIGHT) - 1;
+    return paddle << from ^ paddle << to;
+}
+
+// Pixel rows first to last - 1
+inline uint64_t pixelRowRange(uint8_t first, uint8_t last){
+    if(first >= last) return 0;
+    return (last >= 64 ? UINT64_MAX : (1ull << last) - 1) & ~((1ull << first) - 1);
+}
+
+// Pixel row y alone, if it is on the panel
+inline uint64_t pixelRow(uint8_t y){
+    return y < HEIGHT_PX ? 1ull << y : 0;
+}
+
+// Frame buffer rows in which the paddles of a scene differ from the ones a buffer shows
+uint32_t paddleMoveRows(const BufferPaddles &shown, const GameSnapshot &scene){
+    return scanRowsOf(paddleRowsMoved(shown.left, scene.leftPaddleRow) | paddleRowsMoved(shown.right, scene.rightPaddleRow));
+}
+
+uint32_t sceneDirtyRows(const GameSnapshot &drawn, const GameSnapshot &scene){
+
+    uint64_t dirty = paddleRowsMoved(drawn.leftPaddleRow, scene.leftPaddleRow) | paddleRowsMoved(drawn.rightPaddleRow, scene.rightPaddleRow);
+
+    // The ball's old and new rows
+    if(drawn.ball_x != scene.ball_x | drawn.ball_y != scene.ball_y | drawn.ballColor != scene.ballColor){
+        dirty |= pixelRow(drawn.ball_y) | pixelRow(scene.ball_y);
+    }
+
+    // The rows a score bar grew or shrank by
+    if(drawn.displayScore != scene.displayScore){
+        uint8_t bars[2][2] = { { uint8_t(drawn.displayScore >> 8), uint8_t(scene.displayScore >> 8) },
+                               { uint8_t(drawn.displayScore & UINT8_MAX), uint8_t(scene.displayScore & UINT8_MAX) } };
+        for(auto &bar : bars){
+            uint8_t low = bar[0] < bar[1] ? bar[0] : bar[1];
+            uint8_t high = bar[0] < bar[1] ? bar[1] : bar[0];
+            dirty |= pixelRowRange(low, high < HEIGHT_PX ? high : HEIGHT_PX);
         }
+    }
 
-        // The rgb matrix has 16 row select values. Each row select value displays 2 different rows. Row_counter counts from
-        // 0 to 16. Row_counter is used to generate two rows numbers, row_1 and row_2.
-        for(uint8_t row_counter = 0; row_counter < HEIGHT_PX/2; row_counter++){
-
-            uint8_t row_1 = row_counter; // First row in simulation space being displayed
-            uint8_t row_2 = row_counter + 16; // Second row in simulation space being displayed
-
-            // the rgb matrix indexes rows from top to bottom, so the row counter must be flipped
-            uint8_t row_out = HEIGHT_PX/2 - 1 - row_counter; 
-
-
-            // HUGE improvement with local variables:
-            mtx.lock(); // Store extern variables once locally per frame so that the mutex is only needed once per frame
-            uint8_t leftPaddleRow = leftPaddle->y_idx; // Row of the lowest pixel in the left paddle
-            uint8_t rightPaddleRow = rightPaddle->y_idx; // Row of the lowest pixel in the right paddle
-            uint16_t barHeights = display_score; // Heights of the left and right score bars
-            uint8_t ballColor = ball->color;
-            uint8_t ball_x = ball->x_int;
-            uint8_t ball_y = ball->y_int;
-            bool showText = showPongText;
-            mtx.unlock();
-
-            // Loop through every col in this row
-            for(int col = 0; col < WIDTH_PX; col++){
-
-                // Checks if the current column is the leftmost column
-                if(col == 0){
-
-                    // Check if row_1 of RGB1 is occupied by paddle
-                    if((row_1 >= leftPaddleRow) & (row_1 <= leftPaddleRow + PADDLE_HEIGHT - 1)){ GPIOC->PSOR = (COLOR_GREEN << 8); }
-                    // Check if row_2 of RGB2 is occupied by paddle
-                    if((row_2 >= leftPaddleRow) & (row_2 <= leftPaddleRow + PADDLE_HEIGHT - 1)){
-                        GPIOC->PSOR = (COLOR_GREEN << 11);
-                    }
-                } else if(col == WIDTH_PX - 1){ // Checks if the current column is the rightmost column
-
-                    // Check if row_1 of RGB1 is occupied by paddle
-                    if((row_1 >= rightPaddleRow) & (row_1 <= rightPaddleRow + PADDLE_HEIGHT - 1)){ GPIOC->PSOR = (COLOR_GREEN << 8); }
-                    // Check if row_2 of RGB2 is occupied by paddle
-                    if((row_2 >= rightPaddleRow) & (row_2 <= rightPaddleRow + PADDLE_HEIGHT - 1)){ GPIOC->PSOR = (COLOR_GREEN << 11); }
-                }else if(col == WIDTH_PX / 2 + 11 | col == WIDTH_PX / 2 + 12){ // Checks if the current column is the right score columns
-
-                    // Display the right score bar
-                    if(row_1 < (barHeights & UINT8_MAX)){ GPIOC->PSOR = (SCORE_COLOR << 8); }
-                    if(row_2 < (barHeights & UINT8_MAX)){ GPIOC->PSOR = (SCORE_COLOR << 11); }
-                }else if(col == WIDTH_PX / 2 - 12 | col == WIDTH_PX / 2 - 13){ // Checks if the current column is the left score columns
-
-                    // Display the left score bar
-                    if(row_1 < (barHeights >> 8)){ GPIOC->PSOR = (SCORE_COLOR << 8); }
-                    if(row_2 < (barHeights >> 8)){ GPIOC->PSOR = (SCORE_COLOR << 11); }
-                }
-
-                // Display the ball
-                if(col == ball_x) {  // This code displays the ball once its coordinate is reached
-                    if(row_1 == ball_y) { GPIOC->PSOR = (ballColor << 8); }
-                    if(row_2 == ball_y) { GPIOC->PSOR = (ballColor << 11); }
-                }
-
-                // Display pong text
-                if(col >= text_origin[0] & col <= text_origin[0] + 15 & showText) {
-                    if (row_1 >= text_origin[1] & row_1 <= text_origin[1] + 4) { if(pongTextMatrix[row_1-13] & (1 << (38 - col))) { GPIOC->PSOR = (ballColor << 8); } }
-                    if (row_2 >= text_origin[1] & row_2 <= text_origin[1] + 4) { if(pongTextMatrix[row_2-13] & (1 << (38 - col))) { GPIOC->PSOR = (ballColor << 11); } }
-                }
-
-                GPIOC->PSOR = 4; // Set CLK high
-                GPIOC->PCOR = (7 << 11) | (7 << 8) | 4; // Clear CLK, RGB1, RGB2
-            }
-
-            GPIOC->PSOR = 2; // OE LOW
-            GPIOC->PDOR = (row_out << 3) | 1; // Set row select and set LATCH
-            GPIOC->PCOR = 1; // Clear latch
+    // The text takes the ball's color, so it changes with it as well as when it comes and goes
+    if(drawn.showText != scene.showText || (scene.showText && drawn.ballColor != scene.ballColor)){
+        for(uint8_t y = 0; y < HEIGHT_PX; y++){
+            for(uint8_t w = 0; w < ROW_MASK_WORDS; w++){ if(titleMask[y].word[w]) dirty |= 1ull << y; }
         }
     }
+
+#if MULTIBALL_ENABLED
+    // The extra balls aren't tracked one by one, so any of them anywhere redraws everything
+    if(drawn.ballCount > 0 || scene.ballCount > 0) dirty = UINT64_MAX;
+#endif
+
+    return scanRowsOf(dirty);
+}
+
+// Remembers the paddles of a scene drawn into a buffer
+void drewPaddles(uint8_t buffer, const GameSnapshot &scene){
+    BufferPaddles &paddles = bufferPaddles[buffer];
+    paddles.moveRows = paddleMoveRows(bufferPaddles[frontBuffer], scene);
+    paddles.left = scene.leftPaddleRow;
+    paddles.right = scene.rightPaddleRow;
+    paddles.inputUs = scene.inputUs;
+}
+
+// Swaps the back buffer in. Call between frames
+inline void swapBuffers(){
+    frontBuffer = backBuffer();
+    bufferSwaps.fetch_add(1, std::memory_order_release);
+    TRACE_INPUT_SHOWN(bufferPaddles[frontBuffer].inputUs, bufferPaddles[frontBuffer].moveRows);
+}
+
+// Draw the scene into the dirty rows of a frame buffer. Every element is drawn directly at its location instead of
+// testing every pixel against every element
+void renderScene(const GameSnapshot &scene, port_word_t rows[][WIDTH_PX], uint32_t dirtyRows){
+
+    dirtyRows &= ALL_SCAN_ROWS;
+    if(dirtyRows == ALL_SCAN_ROWS) { memset(rows, 0, sizeof(port_word_t) * SCAN_ROWS * WIDTH_PX); }
+    else {
+        for(uint8_t row = 0; row < SCAN_ROWS; row++){ if(dirtyRows >> row & 1) memset(rows[row], 0, sizeof(port_word_t) * WIDTH_PX); }
+    }
+
+    // Paddles in the leftmost and rightmost columns
+    for(uint8_t y = 0; y < PADDLE_HEIGHT; y++){
+        if(rowDirty(dirtyRows, scene.leftPaddleRow + y)) setPixel(rows, 0, scene.leftPaddleRow + y, COLOR_GREEN);
+        if(rowDirty(dirtyRows, scene.rightPaddleRow + y)) setPixel(rows, WIDTH_PX - 1, scene.rightPaddleRow + y, COLOR_GREEN);
+    }
+
+    // Ball
+    if(scene.ball_x < WIDTH_PX & scene.ball_y < HEIGHT_PX && rowDirty(dirtyRows, scene.ball_y)) { setPixel(rows, scene.ball_x, scene.ball_y, scene.ballColor); }
+
+    // Pong text
+    if(scene.showText) { drawMask(rows, titleMask, scene.ballColor, dirtyRows); }
+
+    // Score bars, two columns wide on either side of the center, drawn last so they stay behind everything else
+    uint8_t leftBar = scene.displayScore >> 8;
+    uint8_t rightBar = scene.displayScore & UINT8_MAX;
+    for(uint8_t y = 0; y < leftBar & y < HEIGHT_PX; y++){
+        if(!rowDirty(dirtyRows, y)) continue;
+        setScorePixel(rows, WIDTH_PX / 2 - 13, y);
+        setScorePixel(rows, WIDTH_PX / 2 - 12, y);
+    }
+    for(uint8_t y = 0; y < rightBar & y < HEIGHT_PX; y++){
+        if(!rowDirty(dirtyRows, y)) continue;
+        setScorePixel(rows, WIDTH_PX / 2 + 11, y);
+        setScorePixel(rows, WIDTH_PX / 2 + 12, y);
+    }
+}
+
+void rgb_matrix_scan_row(const port_word_t columns[WIDTH_PX], uint8_t row_counter){
+
+    uint32_t port = latchedRowWord;
+
+    // Two writes per column: put the data on the lanes with CLK low, then raise CLK to shift it in
+    for(int col = 0; col < WIDTH_PX; col++){
+        GPIOC->PDOR = port | columns[col];
+        GPIOC->PDOR = port | columns[col] | PORT_CLK;
+    }
+
+    // the rgb matrix indexes rows from top to bottom, so the row counter must be flipped
+    uint8_t row_out = SCAN_ROWS - 1 - row_counter; 
+    latchedRowWord = row_out << PORT_ROW_SHIFT;
+
+    GPIOC->PSOR = PORT_OE; // OE LOW
+    GPIOC->PDOR = latchedRowWord | PORT_LAT; // Set row select and set LATCH
+    GPIOC->PCOR = PORT_LAT; // Clear latch
+}
+
+// Frame bookkeeping at the start of every frame. The time since the previous frame started is the period of one
+// frame being displayed
+inline void countFrame(){
+    uint32_t now_us = us_ticker_read();
+    TRACE_VALUE(TRACE_FRAME_PERIOD, now_us - frameStart_us);
+    frameStart_us = now_us;
+    matrixFrames++;
+    scanStats.frames++;
+}
+
+// Draws the latest game state into the back buffer. Returns false if it didn't change or the simulation is
+// publishing right now, and the current scene is kept
+bool renderLatestScene(){
+    GameSnapshot scene;
+    TRACE_START(readStart);
+    bool fresh = readSnapshot(scene);
+    TRACE_CYCLES(TRACE_SNAPSHOT_READ, readStart);
+    if(!fresh) staleSnapshots++;
+    if(!fresh || (sceneRendered && memcmp(&scene, &renderedScene, sizeof(GameSnapshot)) == 0)) return false;
+
+    // Only the rows the scene changes from what the buffer holds are drawn again
+    uint8_t buffer = backBuffer();
+    uint32_t dirtyRows = (sceneDirtyRows(bufferScene[buffer], scene) | ~bufferValidRows[buffer]) & ALL_SCAN_ROWS;
+    renderScene(scene, frameBuffer[buffer], dirtyRows);
+    bufferScene[buffer] = scene;
+    bufferValidRows[buffer] = ALL_SCAN_ROWS;
+    renderStats.scenes++;
+    renderStats.rows += __builtin_popcount(dirtyRows);
+#if MULTIBALL_ENABLED
+    // The extra balls come from their pixel layer. If the simulation got to it first, try again next time
+    if(scene.ballCount > 0 && !multiball_draw(frameBuffer[buffer], scene)) {
+        bufferValidRows[buffer] = 0;
+        staleSnapshots++;
+        return false;
+    }
+#endif
+    drewPaddles(buffer, scene);
+    renderedScene = scene;
+    sceneRendered = true;
+    return true;
+}
+
+// Blanks the panel at the end of a row's lit time
+void blankRow(){
+    GPIOC->PSOR = PORT_OE;
+    rowBlanked();
+}
+
+void rgb_matrix_start_scan(){
+    scanRow = 0;
+    scanTicker.attach(rgb_matrix_scan_tick, std::chrono::microseconds(scanSchedule.rowUs));
+}
+
+void rgb_matrix_scan_tick(){
+
+    TRACE_START(tickStart);
+    if(scanRow == 0){
+        countFrame();
+        // A new refresh rate starts with the frame, so that no frame mixes two row periods
+        if(applyScanRequest()) { scanTicker.attach(rgb_matrix_scan_tick, std::chrono::microseconds(scanSchedule.rowUs)); }
+    }
+    rowBlanked(); // The shift below blanks the previous row
+
+    // The panel stays blank while the row is shifted in, so every row is lit for the same time however long the
+    // shift took
+    const port_word_t *columns = frameBuffer[frontBuffer][scanRow];
+    uint32_t port = latchedRowWord | PORT_OE;
+    for(int col = 0; col < WIDTH_PX; col++){
+        GPIOC->PDOR = port | columns[col];
+        GPIOC->PDOR = port | columns[col] | PORT_CLK;
+    }
+
+    // the rgb matrix indexes rows from top to bottom, so the row counter must be flipped
+    uint8_t row_out = SCAN_ROWS - 1 - scanRow;
+    latchedRowWord = row_out << PORT_ROW_SHIFT;
+
+    GPIOC->PDOR = latchedRowWord | PORT_OE | PORT_LAT; // Set row select and set LATCH
+    if(scanSchedule.litUs > 0){
+        GPIOC->PDOR = latchedRowWord; // Clear latch and light the row
+        rowLit(us_ticker_read());
+        if(scanSchedule.litUs < scanSchedule.rowUs) { blankTimeout.attach(blankRow, std::chrono::microseconds(scanSchedule.litUs)); }
+    } else {
+        GPIOC->PDOR = latchedRowWord | PORT_OE; // Clear latch, the panel is off
+    }
+    TRACE_ROW_LATCHED(scanRow);
+#if TRACE_ENABLED
+    if(scanLatchValid) { trace_record(TRACE_ROW_DWELL, trace_cycles_since(scanLatch)); }
+    scanLatch = trace_start();
+    scanLatchValid = true;
+#endif
+
+    // Only swap between frames, so a frame never shows half of two scenes
+    if(++scanRow == SCAN_ROWS){
+        scanRow = 0;
+        if(swapPending.load()){
+            swapBuffers();
+            swapPending = false;
+        }
+    }
+
+    TRACE_CYCLES(TRACE_SCAN_TICK, tickStart);
+}
+
+#if INPUT_LOW_LATENCY
+// Colour of a pixel in one of the two paddle columns, everything renderScene() draws there
+inline uint8_t edgePixel(const GameSnapshot &scene, uint8_t x, uint8_t y){
+    uint8_t color = static_cast<uint8_t>(y - (x == 0 ? scene.leftPaddleRow : scene.rightPaddleRow)) < PADDLE_HEIGHT ? COLOR_GREEN : 0;
+    if(scene.ball_x == x & scene.ball_y == y) color |= scene.ballColor;
+    if(scene.showText && titleMask[y].word[x / 64] >> (x % 64) & 1) color |= scene.ballColor;
+    return color;
+}
+
+// Redraws the paddle columns of a frame buffer for a scene. Every port word is written once, so a row scanned in the
+// middle of it shows either the old or the new pixels. Extra balls in these columns wait for the next full redraw
+void drawPaddleColumns(port_word_t rows[][WIDTH_PX], const GameSnapshot &scene){
+    for(uint8_t x : { 0, WIDTH_PX - 1 }){
+        for(uint8_t row = 0; row < SCAN_ROWS; row++){
+            rows[row][x] = edgePixel(scene, x, row) << PORT_RGB1_SHIFT | edgePixel(scene, x, row + SCAN_ROWS) << PORT_RGB2_SHIFT;
+        }
+    }
+}
+
+// Fast path for slider moves: a scene whose paddles differ from the panel's has its paddle columns drawn straight
+// into the buffer being scanned, and into the back buffer so that a pending swap doesn't bring the old ones back.
+// The rows still to be scanned in this frame show the move, instead of it waiting for the swap after this frame
+void showPaddles(){
+    GameSnapshot scene;
+    if(!readSnapshot(scene)) return;
+    const BufferPaddles &shown = bufferPaddles[frontBuffer];
+    if(scene.leftPaddleRow == shown.left & scene.rightPaddleRow == shown.right) return;
+
+    // The move is on the panel from here on, so a swap doesn't time it again
+    uint32_t moveRows = paddleMoveRows(shown, scene);
+    for(uint8_t b = 0; b < FRAME_BUFFERS; b++){
+        drawPaddleColumns(frameBuffer[b], scene);
+        bufferPaddles[b] = { scene.leftPaddleRow, scene.rightPaddleRow, scene.inputUs, 0 };
+        // The paddle columns now hold this scene and the rest of the buffer the one before
+        bufferValidRows[b] &= ~sceneDirtyRows(bufferScene[b], scene);
+    }
+    TRACE_INPUT_SHOWN(scene.inputUs, moveRows);
+}
+#endif
+
+bool rgb_matrix_render(){
+#if INPUT_LOW_LATENCY
+    showPaddles();
+#endif
+    if(swapPending.load()) return false;
+    if(renderLatestScene()) swapPending = true;
+    return true;
+}
+
+void rgb_matrix_blank(){
+    GPIOC->PSOR = PORT_OE;
+    latchedRowWord |= PORT_OE;
+    rowBlanked();
+}
+
+// Keeps the row the scan loop just latched lit for its share of the row slot, then blanks it and waits until the next
+// row has to start shifting in to be latched at the end of the slot. The panel stays blank while a row is shifted in
+// after a blanked one, because the kernel keeps OE from latchedRowWord on the port
+void scanRowDwell(uint32_t latch_us){
+    uint32_t shiftStart = scanSchedule.rowUs > scanShiftTime ? scanSchedule.rowUs - scanShiftTime : 0;
+    if(scanSchedule.litUs < shiftStart){
+        waitUntil(latch_us + scanSchedule.litUs);
+        rgb_matrix_blank();
+    }
+    idleUntil(latch_us + shiftStart);
+}
+
+// Scans over every row, one row per row slot of the schedule. The columns of each row are streamed from the front
+// buffer, so the time spent per row no longer depends on what is being displayed.
+void rgb_matrix_frame(){
+
+    countFrame();
+    applyScanRequest();
+
+    // Pick up the latest game state. A new scene is drawn into the back buffer and swapped in at this frame boundary
+#if EXECUTIVE_ENABLED
+    bool swap = swapPending.load();
+    swapPending = false;
+#else
+    bool swap = renderLatestScene();
+#endif
+    if(swap){
+        swapBuffers();
+#if BCM_ENABLED
+        bcm_load_frame(frameBuffer[frontBuffer]);
+#endif
+    }
+
+#if BCM_ENABLED
+    bcm_scan_frame();
+#else
+    // The rgb matrix has 16 row select values. Each row select value displays 2 different rows, one on the RGB1 lanes
+    // and one on the RGB2 lanes, so each row pair is one row of the frame buffer.
+#if TRACE_ENABLED
+    TraceStart rowLatch;
+#endif
+    for(uint8_t row_counter = 0; row_counter < SCAN_ROWS; row_counter++){
+
+        uint32_t shiftStart = us_ticker_read();
+        rgb_matrix_scan_row(frameBuffer[frontBuffer][row_counter], row_counter);
+        rowBlanked(); // The previous row went dark when this one was latched
+        TRACE_ROW_LATCHED(row_counter);
+        uint32_t latch_us = us_ticker_read();
+        if(latch_us - shiftStart > scanShiftTime) { scanShiftTime = latch_us - shiftStart; }
+        if(scanSchedule.litUs > 0) { rowLit(latch_us); }
+
+        // The first row of a frame was latched before the scene was rendered, so its dwell isn't a scan time
+#if TRACE_ENABLED
+        if(row_counter > 0) { trace_record(TRACE_ROW_DWELL, trace_cycles_since(rowLatch)); }
+        rowLatch = trace_start();
+#endif
+
+        scanRowDwell(latch_us);
+    }
+#endif
 }
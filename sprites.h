@@ -0,0 +1,75 @@
+/* Copyright 2023 Collin Bollinger
+ *
+ * sprites.h
+ *
+ * Sprites generated at compile time from ASCII art, and a blitter that draws them into row bitmasks of any panel
+ * width. A blit costs one shift and OR per sprite row wherever the sprite is placed, and a mask is turned into pixels
+ * once per rendered frame by renderScene().
+ */
+
+#ifndef SPRITES_H
+#define SPRITES_H
+
+#include "pong.h"
+
+#define SPRITE_MAX_WIDTH 16
+#define SPRITE_MAX_HEIGHT 8
+
+#define ROW_MASK_WORDS ((WIDTH_PX + 63) / 64)
+
+// One bit per column of a panel row, bit x % 64 of word x / 64 for column x
+struct RowMask {
+    uint64_t word[ROW_MASK_WORDS];
+};
+
+// Title screen text layer, blitted once by rgb_matrix_init()
+extern RowMask titleMask[HEIGHT_PX];
+
+struct Sprite {
+    uint8_t width;
+    uint8_t height;
+    uint16_t rows[SPRITE_MAX_HEIGHT]; // Top row first, bit 0 is the leftmost column
+
+    constexpr Sprite() : width(0), height(0), rows() {}
+
+    /* From ASCII art given as one string of width characters per row, top row first. '#' is lit, anything else is
+     * dark */
+    constexpr Sprite(uint8_t w, const char *art) : width(w), height(0), rows() {
+        uint8_t length = 0;
+        while (art[length]) length++;
+        height = length / w;
+        for (uint8_t r = 0; r < height; r++) {
+            for (uint8_t c = 0; c < w; c++) {
+                if (art[r * w + c] == '#') rows[r] |= 1 << c;
+            }
+        }
+    }
+};
+
+// Title screen logo
+constexpr Sprite pongLogo(16,
+    "###.........####"
+    "#.#.........#..."
+    "###.###.###.#.##"
+    "#...#.#.#.#.#..#"
+    "#...###.#.#.####");
+
+static_assert(pongLogo.height == 5, "Logo art must be whole rows");
+
+/* ORs a sprite into mask with its bottom left corner at column x, row y. Rows count up from the bottom of the panel
+ * like the game coordinates, so the top row of the art ends up highest. Parts off the panel are clipped */
+inline void blitSprite(RowMask mask[HEIGHT_PX], const Sprite &sprite, int x, int y){
+    if (x >= WIDTH_PX | x <= -SPRITE_MAX_WIDTH) return;
+    int word = x < 0 ? 0 : x / 64;
+    int shift = x < 0 ? 0 : x % 64;
+    for (uint8_t r = 0; r < sprite.height; r++) {
+        int row = y + sprite.height - 1 - r;
+        if (row < 0 | row >= HEIGHT_PX) continue;
+        uint64_t bits = x < 0 ? sprite.rows[r] >> -x : sprite.rows[r];
+        mask[row].word[word] |= bits << shift;
+        // The part of a sprite that crosses into the next word
+        if (shift > 64 - SPRITE_MAX_WIDTH & word + 1 < ROW_MASK_WORDS) mask[row].word[word + 1] |= bits >> (64 - shift);
+    }
+}
+
+#endif
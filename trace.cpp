@@ -0,0 +1,101 @@
+/* Copyright 2023 Collin Bollinger
+ *
+ * trace.cpp
+ */
+
+#include "trace.h"
+#include "pong_input.h"
+#include "multiball.h"
+
+uint16_t traceHistogram[TRACE_EVENTS][TRACE_BUCKETS];
+TraceTotals traceTotals[TRACE_EVENTS];
+TraceRecord traceRing[TRACE_RING_SIZE];
+uint32_t traceHead = 0; // Total records written, the next one goes to traceHead % TRACE_RING_SIZE
+
+// Paddle move being timed. latencyRows holds the frame buffer rows it changed until the first of them is latched. The
+// scan interrupt can't be interrupted by the thread arming it, and the rows are cleared while the time changes
+uint32_t latencyInputUs = 0;
+std::atomic<uint32_t> latencyRows(0);
+
+static_assert(SCAN_ROWS <= 32, "The rows of a paddle move are kept as a bit mask");
+
+uint32_t trace_cycles_since(const TraceStart &start){
+    uint32_t us = us_ticker_read() - start.us;
+    if(us < 500) return systickCyclesSince(start.cycles);
+    return us * (SystemCoreClock / 1000000);
+}
+
+void trace_record(uint8_t event, uint32_t value){
+
+    uint8_t bucket = trace_bucket(value);
+    uint32_t now = us_ticker_read();
+
+    // Both threads trace, so the update can't be interrupted halfway. It only takes a few dozen cycles
+    core_util_critical_section_enter();
+    uint16_t *counts = traceHistogram[event];
+    if(counts[bucket] == UINT16_MAX){
+        // Only every 65536 values at most, so the few microseconds this takes don't add up. Rounded up so that no
+        // bucket with values in it goes empty
+        for(uint8_t b = 0; b < TRACE_BUCKETS; b++) counts[b] = (counts[b] + 1) / 2;
+    }
+    counts[bucket]++;
+    TraceTotals &totals = traceTotals[event];
+    if(totals.count++ == 0 || value < totals.min) totals.min = value;
+    if(value > totals.max) totals.max = value;
+    TraceRecord &record = traceRing[traceHead++ % TRACE_RING_SIZE];
+    record.time_us = now;
+    record.value_event = (value > 0xFFFFFF ? 0xFFFFFF : value) | static_cast<uint32_t>(event) << 24;
+    core_util_critical_section_exit();
+}
+
+void trace_input_shown(uint32_t input_us, uint32_t rows){
+    if(rows == 0 | input_us == 0 | input_us == latencyInputUs) return;
+    latencyRows.store(0, std::memory_order_relaxed);
+    latencyInputUs = input_us;
+    latencyRows.store(rows, std::memory_order_release);
+}
+
+void trace_row_latched(uint8_t row){
+    if(!(latencyRows.load(std::memory_order_acquire) >> row & 1)) return;
+    latencyRows.store(0, std::memory_order_relaxed);
+    trace_record(TRACE_INPUT_LATENCY, us_ticker_read() - latencyInputUs);
+}
+
+void trace_dump(void (*write)(const void *data, size_t size)){
+
+    uint32_t head = traceHead;
+    uint32_t records = head < TRACE_RING_SIZE ? head : TRACE_RING_SIZE;
+
+    TraceDumpHeader header = { TRACE_MAGIC, TRACE_VERSION, TRACE_EVENTS, TRACE_BUCKETS, TRACE_COUNTERS, us_ticker_read(), records };
+    write(&header, sizeof(header));
+
+#if MULTIBALL_ENABLED
+    uint32_t ballCount = balls.count, sustained = multiballSustained;
+#else
+    uint32_t ballCount = 0, sustained = 0;
+#endif
+    uint32_t counters[TRACE_COUNTERS] = { game.simulationTicks, game.droppedTicks, game.simulationWakeups, matrixFrames, staleSnapshots,
+                                          droppedInputEvents, ballCount, sustained };
+    write(counters, sizeof(counters));
+
+    // One event at a time, so interrupts are only held off for a short copy
+    for(uint8_t event = 0; event < TRACE_EVENTS; event++){
+        uint16_t counts[TRACE_BUCKETS];
+        core_util_critical_section_enter();
+        TraceTotals totals = traceTotals[event];
+        memcpy(counts, traceHistogram[event], sizeof(counts));
+        memset(traceHistogram[event], 0, sizeof(counts));
+        traceTotals[event] = {};
+        core_util_critical_section_exit();
+        write(&totals, sizeof(totals));
+        write(counts, sizeof(counts));
+    }
+
+    // Records written while the dump is going out can overwrite the oldest ones. They are still whole records
+    for(uint32_t i = head - records; i != head; i++){
+        core_util_critical_section_enter();
+        TraceRecord record = traceRing[i % TRACE_RING_SIZE];
+        core_util_critical_section_exit();
+        write(&record, sizeof(record));
+    }
+}
@@ -0,0 +1,153 @@
+/* Copyright 2023 Collin Bollinger
+ *
+ * trace.h
+ *
+ * Performance instrumentation. Each trace point adds its value to a log-linear histogram for its event and to a fixed
+ * size ring of the most recent events. Nothing is formatted on the device: the main thread writes everything out over
+ * the serial port as one compact binary dump every TRACE_DUMP_MS, and host/trace_decode turns the dumps into
+ * percentiles.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "pong.h"
+
+#ifndef TRACE_ENABLED
+#define TRACE_ENABLED 0 // Set to 1 to record trace points and dump them over the serial port. Change as necessary
+#endif
+
+#define TRACE_RING_SIZE 64 // Most recent events kept with their timestamps. Must be a power of 2
+#define TRACE_SUB_BITS 2 // Every power of 2 is split into 2^TRACE_SUB_BITS histogram buckets of equal width
+#define TRACE_TOP_BITS 22 // Values from 2^TRACE_TOP_BITS up all go into the last bucket
+#define TRACE_BUCKETS ((TRACE_TOP_BITS - TRACE_SUB_BITS + 1) << TRACE_SUB_BITS)
+#define TRACE_DUMP_MS 10000 // Time between dumps
+
+#define TRACE_MAGIC 0x43525450 // "PTRC" in little endian, marks the start of a dump in the serial stream
+#define TRACE_VERSION 5
+
+static_assert((TRACE_RING_SIZE & (TRACE_RING_SIZE - 1)) == 0, "The ring index wraps with a mask");
+static_assert(TRACE_BUCKETS <= UINT8_MAX, "Bucket indexes are uint8_t");
+
+enum TraceEvent : uint8_t {
+    TRACE_FRAME_PERIOD,   // Microseconds from the start of one matrix frame to the next
+    TRACE_ROW_DWELL,      // Cycles a row pair stays latched before the next one replaces it
+    TRACE_STEP_TIME,      // Cycles spent in simulation_step()
+    TRACE_PHYSICS,        // Cycles spent in updateBallState()
+    TRACE_SNAPSHOT_READ,  // Cycles the display thread spends getting the game state from readSnapshot()
+    TRACE_WAKEUP_LATENCY, // Microseconds the simulation thread woke up later than it asked to
+    TRACE_SCAN_TICK,      // Cycles spent in the row interrupt, rgb_matrix_scan_tick()
+    TRACE_MULTIBALL,      // Cycles spent moving the extra balls in one tick, multiball_update()
+    TRACE_INPUT_LATENCY,  // Microseconds from the slider sample that moved a paddle to the first row showing the move
+    TRACE_EVENTS
+};
+
+// Running totals sent with every dump
+enum TraceCounter : uint8_t {
+    TRACE_TICKS,           // game.simulationTicks
+    TRACE_DROPPED_TICKS,   // game.droppedTicks
+    TRACE_WAKEUPS,         // Calls to simulation_step()
+    TRACE_FRAMES,          // Calls to rgb_matrix_frame()
+    TRACE_STALE_SNAPSHOTS, // readSnapshot() calls that returned false
+    TRACE_DROPPED_INPUT,   // droppedInputEvents
+    TRACE_BALLS,           // Extra balls in play (multiball.h)
+    TRACE_SUSTAINED_BALLS, // multiballSustained
+    TRACE_COUNTERS
+};
+
+// Layout of a dump. All fields are little endian. The header is followed by TRACE_COUNTERS uint32_t counters, then
+// for every event its TraceTotals and buckets uint16_t histogram counts, and then records TraceRecords, oldest first
+struct TraceDumpHeader {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t events;
+    uint8_t buckets;
+    uint8_t counters;
+    uint32_t time_us; // us_ticker_read() when the dump was taken
+    uint32_t records;
+};
+
+struct TraceRecord {
+    uint32_t time_us;
+    uint32_t value_event; // Value (saturated to 24 bits) in the low bits and the TraceEvent in the top 8
+};
+
+// Exact figures of an event since the last dump, next to its histogram
+struct TraceTotals {
+    uint32_t count;
+    uint32_t min; // Only set once count isn't 0
+    uint32_t max;
+};
+
+static_assert(sizeof(TraceDumpHeader) == 16 & sizeof(TraceRecord) == 8 & sizeof(TraceTotals) == 12,
+              "The dump layout must not have padding");
+
+/* Histogram and totals of every event and the ring of the most recent records. When a bucket fills up, all of its
+ * event's buckets are halved, so the histogram keeps its shape but no longer adds up to the count */
+extern uint16_t traceHistogram[TRACE_EVENTS][TRACE_BUCKETS];
+extern TraceTotals traceTotals[TRACE_EVENTS];
+extern TraceRecord traceRing[TRACE_RING_SIZE];
+
+/* Histogram bucket of a value. Values below 2^(TRACE_SUB_BITS + 1) each have their own bucket. Above that, the buckets
+ * of every power of 2 split it into 2^TRACE_SUB_BITS equal parts, so a bucket is never wider than 1/2^TRACE_SUB_BITS
+ * of the values in it */
+inline uint8_t trace_bucket(uint32_t value){
+    if(value < 1u << TRACE_SUB_BITS) return value;
+    if(value >= 1u << TRACE_TOP_BITS) return TRACE_BUCKETS - 1;
+    uint8_t shift = 31 - __builtin_clz(value) - TRACE_SUB_BITS;
+    return ((shift + 1) << TRACE_SUB_BITS) + (value >> shift & ((1u << TRACE_SUB_BITS) - 1));
+}
+
+// Smallest value in a histogram bucket, the inverse of trace_bucket()
+inline uint32_t trace_bucket_low(uint8_t bucket){
+    if(bucket < 1u << TRACE_SUB_BITS) return bucket;
+    uint8_t shift = (bucket >> TRACE_SUB_BITS) - 1;
+    return ((1u << TRACE_SUB_BITS) + (bucket & ((1u << TRACE_SUB_BITS) - 1))) << shift;
+}
+
+// Start of a timed section, on both the microsecond ticker and SysTick
+struct TraceStart {
+    uint32_t us;
+    uint32_t cycles;
+};
+
+inline TraceStart trace_start(){ return { us_ticker_read(), SysTick->VAL }; }
+
+/* Cycles since start. SysTick wraps every RTOS tick, so sections longer than half a tick are timed with the
+ * microsecond ticker instead */
+uint32_t trace_cycles_since(const TraceStart &start);
+
+/* Adds a value to the event's histogram and to the ring. Safe to call from any thread */
+void trace_record(uint8_t event, uint32_t value);
+
+/* Writes one dump through write and starts the histograms over. The ring and counters are kept */
+void trace_dump(void (*write)(const void *data, size_t size));
+
+// Counters kept by the display for the dump. The simulation's are in the device GameState
+extern uint32_t matrixFrames;
+extern uint32_t staleSnapshots;
+
+/* Starts timing a paddle move now that it is in the frame buffer being scanned. input_us is the GameSnapshot's
+ * inputUs and rows has a bit set for every frame buffer row the move changed. A move already timed is ignored */
+void trace_input_shown(uint32_t input_us, uint32_t rows);
+
+/* Records the input latency if row is the first row of the move being timed to be latched. Called by the scan
+ * engines right after they latch a frame buffer row */
+void trace_row_latched(uint8_t row);
+
+// Trace points compile to nothing unless TRACE_ENABLED is set
+#if TRACE_ENABLED
+#define TRACE_START(name) TraceStart name = trace_start()
+#define TRACE_CYCLES(event, name) trace_record(event, trace_cycles_since(name))
+#define TRACE_VALUE(event, value) trace_record(event, value)
+#define TRACE_INPUT_SHOWN(input_us, rows) trace_input_shown(input_us, rows)
+#define TRACE_ROW_LATCHED(row) trace_row_latched(row)
+#else
+#define TRACE_START(name) do {} while (0)
+#define TRACE_CYCLES(event, name) do {} while (0)
+#define TRACE_VALUE(event, value) do {} while (0)
+#define TRACE_INPUT_SHOWN(input_us, rows) do {} while (0)
+#define TRACE_ROW_LATCHED(row) do {} while (0)
+#endif
+
+#endif